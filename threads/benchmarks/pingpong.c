@@ -0,0 +1,495 @@
+/**
+ *  Ping-pong benchmark of the hand-off between two threads, the cost the chinese morra and the
+ *  producer-consumer programs pay at every move or item. Thread A stamps the time and wakes
+ *  thread B, B takes the one-way latency and wakes A back, A takes the round trip; every
+ *  primitive is measured with the threads on the same CPU, on two SMT siblings, on two cores of
+ *  the same socket, on two sockets (as found in /sys/devices/system/cpu) and unpinned. Without
+ *  the topology in /sys (some containers and virtual machines) two different CPUs are measured
+ *  as "unknown".
+ *  The primitives are:
+ *  -   cond: a mutex, a condition var and a counter per direction;
+ *  -   sem: a semaphore per direction;
+ *  -   futex: a counter per direction, FUTEX_WAIT / FUTEX_WAKE at every hand-off;
+ *  -   phase: the phase word of ../common/phase.h (spins, sleeps only if needed);
+ *  -   spin: a counter per direction polled with pause, yielding the CPU after a while;
+ *  -   eventfd: an eventfd per direction;
+ *  -   pipe: a pipe per direction, a byte per hand-off.
+ *  The results are printed as CSV on the standard output (latencies in ns, round trips per
+ *  second) and summarized on the standard error as the median round trip of every primitive
+ *  and placement.
+ *  Usage: pingpong [-n iterations] [primitive...]
+*/
+
+#define _GNU_SOURCE  // affinity
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+
+#include "../common/phase.h"
+
+#define WARMUP_ITERATIONS 1000
+#define SPIN_BEFORE_YIELD 1000
+
+typedef enum { SAME_CPU, SMT_SIBLING, SAME_SOCKET, CROSS_SOCKET, UNKNOWN, UNPINNED, PLACEMENTS_NUM } placement;
+
+static const char *const placement_names[PLACEMENTS_NUM] = {"same-cpu", "smt-sibling", "same-socket", "cross-socket",
+                                                           "unknown", "unpinned"};
+
+// one direction of the ping-pong, only the fields of the primitive are used
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    long posted;
+    long taken;
+
+    sem_t sem;
+
+    _Alignas(64) _Atomic uint32_t word;
+    uint32_t seen;  // of the waiter
+    phase ph;
+
+    int fds[2];
+} channel;
+
+typedef struct {
+    const char *name;
+    void (*init)(channel *);
+    void (*destroy)(channel *);
+    void (*signal)(channel *);
+    void (*wait)(channel *);
+} primitive;
+
+typedef struct {
+    pthread_t tid;
+    int cpu;  // -1 if unpinned
+
+    const primitive *prim;
+    channel *ping;
+    channel *pong;
+    long iterations;
+    _Atomic uint64_t *stamp;
+    uint64_t *samples;  // round trips for A, one-way latencies for B
+} thread_data;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void futex_wait(_Atomic uint32_t *word, uint32_t seen) {
+    syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+}
+
+static void futex_wake(_Atomic uint32_t *word) {
+    syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+void cond_init(channel *c) {
+    int err;
+
+    if ((err = pthread_mutex_init(&c->mutex, NULL)) != 0)
+        fprintf(stderr, "Error in pthread_mutex_init: %d\n", err);
+    if ((err = pthread_cond_init(&c->cond, NULL)) != 0)
+        fprintf(stderr, "Error in pthread_cond_init: %d\n", err);
+    c->posted = c->taken = 0;
+}
+
+void cond_destroy(channel *c) {
+    pthread_mutex_destroy(&c->mutex);
+    pthread_cond_destroy(&c->cond);
+}
+
+void cond_signal(channel *c) {
+    pthread_mutex_lock(&c->mutex);
+    c->posted++;
+    pthread_cond_signal(&c->cond);
+    pthread_mutex_unlock(&c->mutex);
+}
+
+void cond_wait(channel *c) {
+    pthread_mutex_lock(&c->mutex);
+    while (c->posted == c->taken)
+        pthread_cond_wait(&c->cond, &c->mutex);
+    c->taken++;
+    pthread_mutex_unlock(&c->mutex);
+}
+
+void sem_channel_init(channel *c) {
+    if (sem_init(&c->sem, 0, 0) != 0)
+        fprintf(stderr, "Error in sem_init\n");
+}
+
+void sem_channel_destroy(channel *c) {
+    sem_destroy(&c->sem);
+}
+
+void sem_signal(channel *c) {
+    sem_post(&c->sem);
+}
+
+void sem_channel_wait(channel *c) {
+    while (sem_wait(&c->sem) != 0)
+        ;  // interrupted by a signal
+}
+
+void word_init(channel *c) {
+    atomic_init(&c->word, 0);
+    c->seen = 0;
+}
+
+void word_destroy(channel *c) {
+    (void)c;
+}
+
+void futex_signal(channel *c) {
+    atomic_fetch_add_explicit(&c->word, 1, memory_order_release);
+    futex_wake(&c->word);
+}
+
+void futex_channel_wait(channel *c) {
+    while (atomic_load_explicit(&c->word, memory_order_acquire) == c->seen)
+        futex_wait(&c->word, c->seen);
+    c->seen++;
+}
+
+void phase_channel_init(channel *c) {
+    phase_init(&c->ph, 0);
+    c->seen = 0;
+}
+
+void phase_signal(channel *c) {
+    phase_add(&c->ph, 1, PHASE_ALL);
+}
+
+void phase_channel_wait(channel *c) {
+    phase_wait_for(&c->ph, ++c->seen, PHASE_ALL);
+}
+
+void spin_signal(channel *c) {
+    atomic_fetch_add_explicit(&c->word, 1, memory_order_release);
+}
+
+void spin_wait(channel *c) {
+    // on the same CPU the other thread runs only if this one lets it
+    for (int i = 0; atomic_load_explicit(&c->word, memory_order_acquire) == c->seen; i++) {
+        if (i < SPIN_BEFORE_YIELD) {
+#ifdef __SSE2__
+            _mm_pause();
+#endif
+        }
+        else
+            sched_yield();
+    }
+    c->seen++;
+}
+
+void eventfd_init(channel *c) {
+    if ((c->fds[0] = c->fds[1] = eventfd(0, 0)) < 0)
+        fprintf(stderr, "Error in eventfd\n");
+}
+
+void eventfd_destroy(channel *c) {
+    close(c->fds[0]);
+}
+
+void eventfd_signal(channel *c) {
+    uint64_t one = 1;
+
+    if (write(c->fds[1], &one, sizeof(one)) != sizeof(one))
+        fprintf(stderr, "Error in write\n");
+}
+
+void eventfd_channel_wait(channel *c) {
+    uint64_t value;
+
+    if (read(c->fds[0], &value, sizeof(value)) != sizeof(value))
+        fprintf(stderr, "Error in read\n");
+}
+
+void pipe_init(channel *c) {
+    if (pipe(c->fds) != 0)
+        fprintf(stderr, "Error in pipe\n");
+}
+
+void pipe_destroy(channel *c) {
+    close(c->fds[0]);
+    close(c->fds[1]);
+}
+
+void pipe_signal(channel *c) {
+    char byte = 0;
+
+    if (write(c->fds[1], &byte, 1) != 1)
+        fprintf(stderr, "Error in write\n");
+}
+
+void pipe_wait(channel *c) {
+    char byte;
+
+    if (read(c->fds[0], &byte, 1) != 1)
+        fprintf(stderr, "Error in read\n");
+}
+
+static const primitive primitives[] = {
+    { "cond", cond_init, cond_destroy, cond_signal, cond_wait },
+    { "sem", sem_channel_init, sem_channel_destroy, sem_signal, sem_channel_wait },
+    { "futex", word_init, word_destroy, futex_signal, futex_channel_wait },
+    { "phase", phase_channel_init, word_destroy, phase_signal, phase_channel_wait },
+    { "spin", word_init, word_destroy, spin_signal, spin_wait },
+    { "eventfd", eventfd_init, eventfd_destroy, eventfd_signal, eventfd_channel_wait },
+    { "pipe", pipe_init, pipe_destroy, pipe_signal, pipe_wait },
+};
+
+#define PRIMITIVES_NUM (int)(sizeof(primitives) / sizeof(primitives[0]))
+
+void ping_thread(void *arg) {
+    thread_data *td = (thread_data *)arg;
+    uint64_t start;
+
+    for (long i = -WARMUP_ITERATIONS; i < td->iterations; i++) {
+        start = now_ns();
+        atomic_store_explicit(td->stamp, start, memory_order_relaxed);
+        td->prim->signal(td->ping);
+        td->prim->wait(td->pong);
+        if (i >= 0)
+            td->samples[i] = now_ns() - start;
+    }
+}
+
+void pong_thread(void *arg) {
+    thread_data *td = (thread_data *)arg;
+    uint64_t end;
+
+    for (long i = -WARMUP_ITERATIONS; i < td->iterations; i++) {
+        td->prim->wait(td->ping);
+        end = now_ns();
+        if (i >= 0)
+            td->samples[i] = end - atomic_load_explicit(td->stamp, memory_order_relaxed);
+        td->prim->signal(td->pong);
+    }
+}
+
+// -1 for the CPUs without the file
+static int read_topology(int cpu, const char *name) {
+    char path[PATH_MAX];
+    FILE *f;
+    int value = -1;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+    if ((f = fopen(path, "r")) == NULL)
+        return -1;
+    if (fscanf(f, "%d", &value) != 1)
+        value = -1;
+    fclose(f);
+    return value;
+}
+
+// the pair of CPUs of every placement, cpus[p][0] == -2 if the machine has none
+static void find_placements(int cpus[PLACEMENTS_NUM][2]) {
+    cpu_set_t allowed;
+    int first = -1, core, package, cpu_core, cpu_package;
+
+    for (int p = 0; p < PLACEMENTS_NUM; p++)
+        cpus[p][0] = cpus[p][1] = -2;
+    cpus[UNPINNED][0] = cpus[UNPINNED][1] = -1;
+
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+        return;
+
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (!CPU_ISSET(cpu, &allowed))
+            continue;
+        if (first < 0) {
+            first = cpu;
+            core = read_topology(cpu, "core_id");
+            package = read_topology(cpu, "physical_package_id");
+            cpus[SAME_CPU][0] = cpus[SAME_CPU][1] = cpu;
+            continue;
+        }
+
+        placement p;
+        cpu_core = read_topology(cpu, "core_id");
+        cpu_package = read_topology(cpu, "physical_package_id");
+        if (core == -1 || package == -1 || cpu_core == -1 || cpu_package == -1)
+            p = UNKNOWN;
+        else if (cpu_package != package)
+            p = CROSS_SOCKET;
+        else if (cpu_core == core)
+            p = SMT_SIBLING;
+        else
+            p = SAME_SOCKET;
+
+        if (cpus[p][0] == -2) {
+            cpus[p][0] = first;
+            cpus[p][1] = cpu;
+        }
+    }
+}
+
+static int compare_samples(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+static uint64_t percentile(const uint64_t *sorted, long n, double p) {
+    long i = (long)(p * (n - 1) + 0.5);
+
+    return sorted[i];
+}
+
+static void start_thread(thread_data *td, void (*f)(void *)) {
+    pthread_attr_t attr;
+    cpu_set_t set;
+    int err;
+
+    pthread_attr_init(&attr);
+    if (td->cpu >= 0) {
+        CPU_ZERO(&set);
+        CPU_SET(td->cpu, &set);
+        pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+    }
+    if ((err = pthread_create(&td->tid, &attr, (void *)f, td)) != 0) {
+        fprintf(stderr, "Error in pthread_create: %d\n", err);
+        exit(1);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+// returns the median round trip
+static uint64_t run(const primitive *prim, placement p, const int cpus[2], long iterations) {
+    channel ping, pong;
+    _Atomic uint64_t stamp;
+    thread_data td[2];
+    uint64_t rt_sum = 0, median;
+    int err;
+
+    prim->init(&ping);
+    prim->init(&pong);
+    atomic_init(&stamp, 0);
+
+    for (int i = 0; i < 2; i++) {
+        td[i].cpu = cpus[i];
+        td[i].prim = prim;
+        td[i].ping = &ping;
+        td[i].pong = &pong;
+        td[i].iterations = iterations;
+        td[i].stamp = &stamp;
+        td[i].samples = malloc(iterations * sizeof(uint64_t));
+    }
+    start_thread(&td[1], pong_thread);
+    start_thread(&td[0], ping_thread);
+
+    for (int i = 0; i < 2; i++) {
+        if ((err = pthread_join(td[i].tid, NULL)) != 0) {
+            fprintf(stderr, "Error in pthread_join: %d\n", err);
+            exit(1);
+        }
+    }
+
+    for (long i = 0; i < iterations; i++)
+        rt_sum += td[0].samples[i];
+    qsort(td[0].samples, iterations, sizeof(uint64_t), compare_samples);
+    qsort(td[1].samples, iterations, sizeof(uint64_t), compare_samples);
+    median = percentile(td[0].samples, iterations, 0.5);
+
+    printf("%s,%s,%d,%d,%ld,%.0f,%lu,%lu,%lu,%lu,%lu,%.0f\n", prim->name, placement_names[p], cpus[0], cpus[1],
+           iterations, (double)rt_sum / iterations, median, percentile(td[0].samples, iterations, 0.99),
+           percentile(td[0].samples, iterations, 0.999), percentile(td[1].samples, iterations, 0.5),
+           percentile(td[1].samples, iterations, 0.99), iterations * 1e9 / rt_sum);
+    fflush(stdout);
+
+    free(td[0].samples);
+    free(td[1].samples);
+    prim->destroy(&ping);
+    prim->destroy(&pong);
+
+    return median;
+}
+
+int main(int argc, char **argv) {
+    long iterations = 100000;
+    bool selected[PRIMITIVES_NUM];
+    int cpus[PLACEMENTS_NUM][2];
+    uint64_t medians[PRIMITIVES_NUM][PLACEMENTS_NUM];
+    char *str_end;
+    int opt, found;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = strtol(optarg, &str_end, 10);
+            if (*str_end != '\0' || iterations <= 0) {
+                fprintf(stderr, "Invalid number of iterations: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-n iterations] [primitive...]\n", argv[0]);
+            exit(1);
+        }
+    }
+
+    for (int i = 0; i < PRIMITIVES_NUM; i++)
+        selected[i] = optind == argc;
+    for (int a = optind; a < argc; a++) {
+        found = 0;
+        for (int i = 0; i < PRIMITIVES_NUM; i++) {
+            if (strcmp(argv[a], primitives[i].name) == 0) {
+                selected[i] = true;
+                found = 1;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "Unknown primitive: %s\n", argv[a]);
+            exit(1);
+        }
+    }
+
+    find_placements(cpus);
+
+    printf("primitive,placement,cpu_a,cpu_b,iterations,rt_mean_ns,rt_p50_ns,rt_p99_ns,rt_p999_ns,"
+           "oneway_p50_ns,oneway_p99_ns,roundtrips_per_s\n");
+    for (int i = 0; i < PRIMITIVES_NUM; i++) {
+        for (int p = 0; p < PLACEMENTS_NUM; p++) {
+            medians[i][p] = 0;
+            if (selected[i] && cpus[p][0] != -2)
+                medians[i][p] = run(&primitives[i], p, cpus[p], iterations);
+        }
+    }
+
+    // summary
+    fprintf(stderr, "\nMedian round trip (ns)\n%-10s", "");
+    for (int p = 0; p < PLACEMENTS_NUM; p++)
+        fprintf(stderr, "%14s", placement_names[p]);
+    fprintf(stderr, "\n");
+    for (int i = 0; i < PRIMITIVES_NUM; i++) {
+        if (!selected[i])
+            continue;
+        fprintf(stderr, "%-10s", primitives[i].name);
+        for (int p = 0; p < PLACEMENTS_NUM; p++) {
+            if (cpus[p][0] == -2)
+                fprintf(stderr, "%14s", "-");
+            else
+                fprintf(stderr, "%14lu", medians[i][p]);
+        }
+        fprintf(stderr, "\n");
+    }
+
+    exit(0);
+}
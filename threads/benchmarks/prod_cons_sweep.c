@@ -0,0 +1,510 @@
+/**
+ *  Scalability sweep of the producer-consumer bounded queue (../common/bounded_queue.h): every
+ *  variant (sync policy cond, sem or lockfree, wait policy block, adaptive or spin) runs with
+ *  2, 4, 8, ... threads up to -t, half producers and half consumers, so the machine goes from
+ *  idle to many times oversubscribed; -C restricts the runs to the first n CPUs, to sweep a
+ *  machine of a fixed size. The producers push for -d milliseconds items stamped with the time,
+ *  then the consumers drain the queue.
+ *  Every run is a child process watched by the parent: a run that does not end within -w
+ *  seconds after its duration is killed and reported as a hang, so a lost wake-up does not
+ *  block the sweep.
+ *  A run reports the throughput, the fairness of the producers and of the consumers as the
+ *  Jain index of the items of every thread (1 when all the threads did the same work, 1/n when
+ *  one thread did all of it), the CPU time (user + system) per item and the percentiles of the
+ *  latency from the push to the pop.
+ *  The results are printed as CSV on the standard output, one line per run (the scaling curve
+ *  of every variant), and summarized on the standard error with the peak throughput of every
+ *  variant, the cliff, the first number of threads after the peak with less than half of it, and
+ *  the number of runs that hanged or failed.
+ *  Usage: prod_cons_sweep [-t max-threads] [-d duration-ms] [-w watchdog-s] [-C cpus] [variant...]
+*/
+
+#define _GNU_SOURCE  // affinity
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <sched.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#define BUFFER_SIZE 10
+#define THREAD_STACK_SIZE (64 * 1024)  // several hundred threads per run
+#define MAX_THREADS 4096
+
+// log-linear histogram of the latencies: 16 buckets per power of two, 6% resolution
+#define HIST_SUB 16
+#define HIST_BUCKETS (64 * HIST_SUB)
+
+typedef struct {
+    uint64_t stamp;  // 0 tells a consumer to stop
+    int producer;
+} sweep_item;
+
+// every variant is an instance of the bounded queue, used through a table of wrappers
+#define SWEEP_WRAPPERS(q) \
+    static void q##_sweep_init(void *p) { q##_init(p); } \
+    static void q##_sweep_destroy(void *p) { q##_destroy(p); } \
+    static void q##_sweep_push(void *p, const sweep_item *x) { q##_push(p, x, NULL); } \
+    static void q##_sweep_pop(void *p, sweep_item *x) { q##_pop(p, x, NULL); }
+
+#define QUEUE_NAME cond_block
+#define QUEUE_TYPE sweep_item
+#define QUEUE_CAPACITY BUFFER_SIZE
+#define QUEUE_SYNC QUEUE_SYNC_COND
+#define QUEUE_WAIT QUEUE_WAIT_BLOCK
+#include "../common/bounded_queue.h"
+SWEEP_WRAPPERS(cond_block)
+
+#define QUEUE_NAME cond_adaptive
+#define QUEUE_TYPE sweep_item
+#define QUEUE_CAPACITY BUFFER_SIZE
+#define QUEUE_SYNC QUEUE_SYNC_COND
+#define QUEUE_WAIT QUEUE_WAIT_ADAPTIVE
+#include "../common/bounded_queue.h"
+SWEEP_WRAPPERS(cond_adaptive)
+
+#define QUEUE_NAME cond_spin
+#define QUEUE_TYPE sweep_item
+#define QUEUE_CAPACITY BUFFER_SIZE
+#define QUEUE_SYNC QUEUE_SYNC_COND
+#define QUEUE_WAIT QUEUE_WAIT_SPIN
+#include "../common/bounded_queue.h"
+SWEEP_WRAPPERS(cond_spin)
+
+#define QUEUE_NAME sem_block
+#define QUEUE_TYPE sweep_item
+#define QUEUE_CAPACITY BUFFER_SIZE
+#define QUEUE_SYNC QUEUE_SYNC_SEM
+#define QUEUE_WAIT QUEUE_WAIT_BLOCK
+#include "../common/bounded_queue.h"
+SWEEP_WRAPPERS(sem_block)
+
+#define QUEUE_NAME sem_adaptive
+#define QUEUE_TYPE sweep_item
+#define QUEUE_CAPACITY BUFFER_SIZE
+#define QUEUE_SYNC QUEUE_SYNC_SEM
+#define QUEUE_WAIT QUEUE_WAIT_ADAPTIVE
+#include "../common/bounded_queue.h"
+SWEEP_WRAPPERS(sem_adaptive)
+
+#define QUEUE_NAME sem_spin
+#define QUEUE_TYPE sweep_item
+#define QUEUE_CAPACITY BUFFER_SIZE
+#define QUEUE_SYNC QUEUE_SYNC_SEM
+#define QUEUE_WAIT QUEUE_WAIT_SPIN
+#include "../common/bounded_queue.h"
+SWEEP_WRAPPERS(sem_spin)
+
+#define QUEUE_NAME lockfree_block
+#define QUEUE_TYPE sweep_item
+#define QUEUE_CAPACITY BUFFER_SIZE
+#define QUEUE_SYNC QUEUE_SYNC_LOCKFREE
+#define QUEUE_WAIT QUEUE_WAIT_BLOCK
+#include "../common/bounded_queue.h"
+SWEEP_WRAPPERS(lockfree_block)
+
+#define QUEUE_NAME lockfree_adaptive
+#define QUEUE_TYPE sweep_item
+#define QUEUE_CAPACITY BUFFER_SIZE
+#define QUEUE_SYNC QUEUE_SYNC_LOCKFREE
+#define QUEUE_WAIT QUEUE_WAIT_ADAPTIVE
+#include "../common/bounded_queue.h"
+SWEEP_WRAPPERS(lockfree_adaptive)
+
+#define QUEUE_NAME lockfree_spin
+#define QUEUE_TYPE sweep_item
+#define QUEUE_CAPACITY BUFFER_SIZE
+#define QUEUE_SYNC QUEUE_SYNC_LOCKFREE
+#define QUEUE_WAIT QUEUE_WAIT_SPIN
+#include "../common/bounded_queue.h"
+SWEEP_WRAPPERS(lockfree_spin)
+
+typedef struct {
+    const char *name;
+    size_t size;
+    void (*init)(void *);
+    void (*destroy)(void *);
+    void (*push)(void *, const sweep_item *);
+    void (*pop)(void *, sweep_item *);
+} variant;
+
+#define VARIANT(name, q) { name, sizeof(q), q##_sweep_init, q##_sweep_destroy, q##_sweep_push, q##_sweep_pop }
+
+static const variant variants[] = {
+    VARIANT("cond", cond_block),
+    VARIANT("cond-adaptive", cond_adaptive),
+    VARIANT("cond-spin", cond_spin),
+    VARIANT("sem", sem_block),
+    VARIANT("sem-adaptive", sem_adaptive),
+    VARIANT("sem-spin", sem_spin),
+    VARIANT("lockfree", lockfree_block),
+    VARIANT("lockfree-adaptive", lockfree_adaptive),
+    VARIANT("lockfree-spin", lockfree_spin),
+};
+
+#define VARIANTS_NUM (int)(sizeof(variants) / sizeof(variants[0]))
+
+typedef struct {
+    const variant *var;
+    void *queue;
+    pthread_barrier_t start;
+    _Atomic bool stop;
+} shared_data;
+
+typedef struct {
+    pthread_t tid;
+    int thread_i;
+    long items;
+    uint64_t *hist;  // consumers only
+
+    shared_data *shared;
+} thread_data;
+
+// what a run sends back to the parent
+typedef struct {
+    long items;
+    double seconds;
+    double jain_producers;
+    double jain_consumers;
+    double cpu_ns_per_item;
+    uint64_t latency[3];  // p50, p99, p99.9
+} run_result;
+
+static const double percentiles[3] = {0.5, 0.99, 0.999};
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int hist_bucket(uint64_t v) {
+    int e;
+
+    if (v < HIST_SUB)
+        return v;
+    e = 63 - __builtin_clzll(v);
+    return (e - 3) * HIST_SUB + (int)(v >> (e - 4)) - HIST_SUB;
+}
+
+// the lowest value of the bucket
+static uint64_t hist_value(int b) {
+    if (b < HIST_SUB)
+        return b;
+    return (uint64_t)(b % HIST_SUB + HIST_SUB) << (b / HIST_SUB - 1);
+}
+
+static double jain_index(const thread_data *td, int n) {
+    double sum = 0, squares = 0;
+
+    for (int i = 0; i < n; i++) {
+        sum += td[i].items;
+        squares += (double)td[i].items * td[i].items;
+    }
+    return squares > 0 ? sum * sum / (n * squares) : 1.0;
+}
+
+static double cpu_seconds(void) {
+    struct rusage ru;
+
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+void producer(void *arg) {
+    thread_data *td = (thread_data *)arg;
+    shared_data *sh = td->shared;
+    sweep_item item = { 0, td->thread_i };
+
+    pthread_barrier_wait(&sh->start);
+    while (!atomic_load_explicit(&sh->stop, memory_order_relaxed)) {
+        item.stamp = now_ns();
+        sh->var->push(sh->queue, &item);
+        td->items++;
+    }
+}
+
+void consumer(void *arg) {
+    thread_data *td = (thread_data *)arg;
+    shared_data *sh = td->shared;
+    sweep_item item;
+
+    pthread_barrier_wait(&sh->start);
+    while (1) {
+        sh->var->pop(sh->queue, &item);
+        if (item.stamp == 0)
+            break;
+        td->hist[hist_bucket(now_ns() - item.stamp)]++;
+        td->items++;
+    }
+}
+
+static void start_thread(thread_data *td, void (*f)(void *)) {
+    pthread_attr_t attr;
+    int err;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, THREAD_STACK_SIZE);
+    if ((err = pthread_create(&td->tid, &attr, (void *)f, td)) != 0) {
+        fprintf(stderr, "Error in pthread_create: %d\n", err);
+        exit(1);
+    }
+    pthread_attr_destroy(&attr);
+}
+
+static void join_thread(thread_data *td) {
+    int err;
+
+    if ((err = pthread_join(td->tid, NULL)) != 0) {
+        fprintf(stderr, "Error in pthread_join: %d\n", err);
+        exit(1);
+    }
+}
+
+// the body of the child process
+static run_result run(const variant *var, int producers_num, int consumers_num, long duration_ms) {
+    shared_data sh;
+    thread_data *prods = calloc(producers_num, sizeof(thread_data));
+    thread_data *cons = calloc(consumers_num, sizeof(thread_data));
+    uint64_t *hist = calloc(HIST_BUCKETS, sizeof(uint64_t));
+    sweep_item stop_item = { 0, -1 };
+    struct timespec duration = { duration_ms / 1000, duration_ms % 1000 * 1000000 };
+    run_result res = {0};
+    uint64_t start, seen;
+    double cpu_start;
+    int b;
+
+    sh.var = var;
+    sh.queue = aligned_alloc(64, (var->size + 63) / 64 * 64);
+    var->init(sh.queue);
+    pthread_barrier_init(&sh.start, NULL, producers_num + consumers_num + 1);
+    atomic_init(&sh.stop, false);
+
+    for (int i = 0; i < producers_num; i++) {
+        prods[i].thread_i = i + 1;
+        prods[i].shared = &sh;
+        start_thread(&prods[i], producer);
+    }
+    for (int i = 0; i < consumers_num; i++) {
+        cons[i].thread_i = i + 1;
+        cons[i].hist = calloc(HIST_BUCKETS, sizeof(uint64_t));
+        cons[i].shared = &sh;
+        start_thread(&cons[i], consumer);
+    }
+
+    pthread_barrier_wait(&sh.start);
+    start = now_ns();
+    cpu_start = cpu_seconds();
+    nanosleep(&duration, NULL);
+
+    // the producers stop, then every consumer takes a stop item after the last real one
+    atomic_store(&sh.stop, true);
+    for (int i = 0; i < producers_num; i++)
+        join_thread(&prods[i]);
+    for (int i = 0; i < consumers_num; i++)
+        var->push(sh.queue, &stop_item);
+    for (int i = 0; i < consumers_num; i++)
+        join_thread(&cons[i]);
+
+    res.seconds = (now_ns() - start) / 1e9;
+    for (int i = 0; i < consumers_num; i++) {
+        res.items += cons[i].items;
+        for (b = 0; b < HIST_BUCKETS; b++)
+            hist[b] += cons[i].hist[b];
+    }
+    res.cpu_ns_per_item = res.items > 0 ? (cpu_seconds() - cpu_start) * 1e9 / res.items : 0;
+    res.jain_producers = jain_index(prods, producers_num);
+    res.jain_consumers = jain_index(cons, consumers_num);
+    for (int p = 0; p < 3; p++) {
+        seen = 0;
+        for (b = 0; b < HIST_BUCKETS - 1; b++) {
+            seen += hist[b];
+            if (seen >= percentiles[p] * res.items)
+                break;
+        }
+        res.latency[p] = hist_value(b);
+    }
+
+    return res;
+}
+
+// runs a configuration in a child process, false if it hanged or failed
+static bool run_child(const variant *var, int producers_num, int consumers_num, long duration_ms, int watchdog_s,
+                      run_result *res, const char **status) {
+    struct pollfd pfd;
+    pid_t pid;
+    int fds[2], wstatus;
+    ssize_t n = 0;
+
+    if (pipe(fds) != 0) {
+        fprintf(stderr, "Error in pipe\n");
+        exit(1);
+    }
+    fflush(stdout);
+    if ((pid = fork()) == -1) {
+        fprintf(stderr, "Error in fork\n");
+        exit(1);
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        *res = run(var, producers_num, consumers_num, duration_ms);
+        if (write(fds[1], res, sizeof(run_result)) != sizeof(run_result))
+            _exit(1);
+        _exit(0);
+    }
+
+    close(fds[1]);
+    pfd.fd = fds[0];
+    pfd.events = POLLIN;
+    *status = "ok";
+    if (poll(&pfd, 1, duration_ms + watchdog_s * 1000L) == 0) {
+        kill(pid, SIGKILL);
+        *status = "hang";
+    }
+    else if ((n = read(fds[0], res, sizeof(run_result))) != sizeof(run_result))
+        *status = "failed";
+    close(fds[0]);
+    waitpid(pid, &wstatus, 0);
+
+    return n == sizeof(run_result);
+}
+
+int main(int argc, char **argv) {
+    long duration_ms = 500;
+    int max_threads = 512, watchdog_s = 10, cpus_num = 0;
+    bool selected[VARIANTS_NUM];
+    double peak[VARIANTS_NUM] = {0};
+    int peak_threads[VARIANTS_NUM] = {0}, cliff[VARIANTS_NUM] = {0}, failed[VARIANTS_NUM] = {0};
+    cpu_set_t set, allowed;
+    run_result res;
+    const char *status;
+    char *str_end;
+    int opt, found, producers_num, consumers_num;
+    double throughput;
+
+    while ((opt = getopt(argc, argv, "t:d:w:C:")) != -1) {
+        switch (opt) {
+        case 't':
+            max_threads = (int)strtol(optarg, &str_end, 10);
+            if (*str_end != '\0' || max_threads < 2 || max_threads > MAX_THREADS) {
+                fprintf(stderr, "Invalid number of threads: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'd':
+            duration_ms = strtol(optarg, &str_end, 10);
+            if (*str_end != '\0' || duration_ms <= 0) {
+                fprintf(stderr, "Invalid duration: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'w':
+            watchdog_s = (int)strtol(optarg, &str_end, 10);
+            if (*str_end != '\0' || watchdog_s <= 0) {
+                fprintf(stderr, "Invalid watchdog: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'C':
+            cpus_num = (int)strtol(optarg, &str_end, 10);
+            if (*str_end != '\0' || cpus_num <= 0) {
+                fprintf(stderr, "Invalid number of CPUs: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-t max-threads] [-d duration-ms] [-w watchdog-s] [-C cpus] [variant...]\n",
+                    argv[0]);
+            exit(1);
+        }
+    }
+
+    for (int i = 0; i < VARIANTS_NUM; i++)
+        selected[i] = optind == argc;
+    for (int a = optind; a < argc; a++) {
+        found = 0;
+        for (int i = 0; i < VARIANTS_NUM; i++) {
+            if (strcmp(argv[a], variants[i].name) == 0) {
+                selected[i] = true;
+                found = 1;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "Unknown variant: %s\n", argv[a]);
+            exit(1);
+        }
+    }
+
+    // the children inherit the CPUs of the parent
+    sched_getaffinity(0, sizeof(allowed), &allowed);
+    if (cpus_num > 0) {
+        CPU_ZERO(&set);
+        for (int c = 0, n = 0; c < CPU_SETSIZE && n < cpus_num; c++) {
+            if (CPU_ISSET(c, &allowed)) {
+                CPU_SET(c, &set);
+                n++;
+            }
+        }
+        if (sched_setaffinity(0, sizeof(set), &set) != 0)
+            fprintf(stderr, "Error in sched_setaffinity\n");
+        allowed = set;
+    }
+    cpus_num = CPU_COUNT(&allowed);
+
+    printf("variant,producers,consumers,threads,cpus,oversubscription,items,seconds,items_per_s,jain_producers,"
+           "jain_consumers,cpu_ns_per_item,lat_p50_ns,lat_p99_ns,lat_p999_ns,status\n");
+    for (int i = 0; i < VARIANTS_NUM; i++) {
+        if (!selected[i])
+            continue;
+        for (int threads = 2; threads <= max_threads; threads *= 2) {
+            producers_num = threads / 2;
+            consumers_num = threads - producers_num;
+            if (!run_child(&variants[i], producers_num, consumers_num, duration_ms, watchdog_s, &res, &status)) {
+                printf("%s,%d,%d,%d,%d,%.2f,,,,,,,,,,%s\n", variants[i].name, producers_num, consumers_num, threads,
+                       cpus_num, (double)threads / cpus_num, status);
+                failed[i]++;
+                continue;
+            }
+
+            throughput = res.items / res.seconds;
+            printf("%s,%d,%d,%d,%d,%.2f,%ld,%.3f,%.0f,%.3f,%.3f,%.0f,%lu,%lu,%lu,%s\n", variants[i].name,
+                   producers_num, consumers_num, threads, cpus_num, (double)threads / cpus_num, res.items,
+                   res.seconds, throughput, res.jain_producers, res.jain_consumers, res.cpu_ns_per_item,
+                   res.latency[0], res.latency[1], res.latency[2], status);
+            fflush(stdout);
+
+            if (throughput > peak[i]) {
+                peak[i] = throughput;
+                peak_threads[i] = threads;
+                cliff[i] = 0;
+            }
+            else if (cliff[i] == 0 && throughput < peak[i] / 2)
+                cliff[i] = threads;
+        }
+    }
+
+    // summary
+    fprintf(stderr, "\n%-18s %14s %12s %12s %6s\n", "variant", "peak items/s", "at threads", "cliff at", "failed");
+    for (int i = 0; i < VARIANTS_NUM; i++) {
+        if (!selected[i])
+            continue;
+        fprintf(stderr, "%-18s %14.0f %12d ", variants[i].name, peak[i], peak_threads[i]);
+        if (cliff[i] > 0)
+            fprintf(stderr, "%12d", cliff[i]);
+        else
+            fprintf(stderr, "%12s", "-");
+        fprintf(stderr, " %6d\n", failed[i]);
+    }
+
+    exit(0);
+}
@@ -0,0 +1,577 @@
+/**
+ * Bounded queue: the circular buffer of the producer-consumer programs, written once and
+ * instantiated for every item type, capacity and policy by defining the parameters and
+ * including the header:
+ *     #define QUEUE_NAME int_queue
+ *     #define QUEUE_TYPE int
+ *     #define QUEUE_CAPACITY 10
+ *     #define QUEUE_SYNC QUEUE_SYNC_SEM        // QUEUE_SYNC_COND by default
+ *     #define QUEUE_WAIT QUEUE_WAIT_ADAPTIVE   // QUEUE_WAIT_BLOCK by default
+ *     #include "bounded_queue.h"
+ * defines the types int_queue and int_queue_item and the functions int_queue_init, int_queue_destroy,
+ * int_queue_push, int_queue_pop (blocking), int_queue_try_push and int_queue_try_pop (false
+ * when the queue is full or empty). The parameters are undefined at the end, so the header
+ * can be included again for another queue. The capacity is a constant, so the index of a
+ * slot is a mask when it is a power of two.
+ * The sync policy protects the buffer:
+ * -   QUEUE_SYNC_COND: a mutex and the not_full and not_empty condition vars;
+ * -   QUEUE_SYNC_SEM: the empty and full counting semaphores and a binary semaphore as mutex;
+ * -   QUEUE_SYNC_LOCKFREE: a sequence number per slot (Vyukov's bounded MPMC queue), with the
+ *     pushes and pops counted on two phase words (phase.h) to sleep on a full or empty queue.
+ * The wait policy says what a thread does on a full or empty queue:
+ * -   QUEUE_WAIT_BLOCK: it sleeps at once;
+ * -   QUEUE_WAIT_SPIN: it never sleeps, it retries with a pause and then yields the CPU;
+ * -   QUEUE_WAIT_ADAPTIVE: it retries QUEUE_SPIN times and then sleeps.
+ * QUEUE_ON_PUSH(q, i, ctx) and QUEUE_ON_POP(q, i, ctx), if defined, are called with the
+ * index of the slot and the ctx given to push and pop, while the thread owns the buffer (cond,
+ * sem) or the slot (lockfree); the items are in q->items.
+ * QUEUE_EVENTFD, if defined, gives the queue an eventfd, q->ready, for the consumers that wait
+ * in an epoll loop instead of in pop: a push that finds the queue empty makes it readable, the
+ * other pushes make no system call. A consumer woken by it calls <QUEUE_NAME>_ready_clear and
+ * then try_pop until the queue is empty; the next push signals again.
+ * With -DLOCKPROF (lockprof.h) the locks are profiled as <QUEUE_NAME>.mutex, .not_full and so on,
+ * with -DTRACE_EVENTS (trace.h) the waits and the critical sections are traced with the same names.
+*/
+
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sched.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "phase.h"
+#include "lockprof.h"
+#include "trace.h"
+
+#define QUEUE_SYNC_COND 1
+#define QUEUE_SYNC_SEM 2
+#define QUEUE_SYNC_LOCKFREE 3
+
+#define QUEUE_WAIT_BLOCK 1
+#define QUEUE_WAIT_SPIN 2
+#define QUEUE_WAIT_ADAPTIVE 3
+
+#ifndef QUEUE_SPIN
+#define QUEUE_SPIN 1000
+#endif
+
+#define QUEUE_CONCAT_(a, b) a##_##b
+#define QUEUE_CONCAT(a, b) QUEUE_CONCAT_(a, b)
+#define QUEUE_STR_(a) #a
+#define QUEUE_STR(a) QUEUE_STR_(a)
+
+// one retry of a spinning wait
+static inline void queue_relax(int i) {
+    if (i < 64) {
+#ifdef __SSE2__
+        _mm_pause();
+#endif
+    }
+    else
+        sched_yield();
+}
+
+// the counter of the eventfd only says that there is something, its value is not used
+static inline void queue_ready_signal(int fd) {
+    uint64_t one = 1;
+
+    if (write(fd, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN)
+        fprintf(stderr, "Error in write: %d\n", errno);
+}
+
+static inline void queue_ready_clear(int fd) {
+    uint64_t count;
+
+    if (read(fd, &count, sizeof(count)) != sizeof(count) && errno != EAGAIN)
+        fprintf(stderr, "Error in read: %d\n", errno);
+}
+
+#endif
+
+#if !defined(QUEUE_NAME) || !defined(QUEUE_TYPE) || !defined(QUEUE_CAPACITY)
+#error "QUEUE_NAME, QUEUE_TYPE and QUEUE_CAPACITY must be defined before including bounded_queue.h"
+#endif
+
+#ifndef QUEUE_SYNC
+#define QUEUE_SYNC QUEUE_SYNC_COND
+#endif
+#ifndef QUEUE_WAIT
+#define QUEUE_WAIT QUEUE_WAIT_BLOCK
+#endif
+#ifndef QUEUE_ON_PUSH
+#define QUEUE_ON_PUSH(q, i, ctx)
+#endif
+#ifndef QUEUE_ON_POP
+#define QUEUE_ON_POP(q, i, ctx)
+#endif
+
+#if QUEUE_CAPACITY <= 0
+#error "QUEUE_CAPACITY must be positive"
+#endif
+
+#define QUEUE_FN(f) QUEUE_CONCAT(QUEUE_NAME, f)
+#define QUEUE_INDEX(pos) ((QUEUE_CAPACITY & (QUEUE_CAPACITY - 1)) == 0 ? (pos) & (QUEUE_CAPACITY - 1) : (pos) % QUEUE_CAPACITY)
+
+// a type name, so that const applies to a pointer item too
+typedef QUEUE_TYPE QUEUE_FN(item);
+
+typedef struct {
+    QUEUE_FN(item) items[QUEUE_CAPACITY];
+#if QUEUE_SYNC == QUEUE_SYNC_LOCKFREE
+    _Atomic size_t seqs[QUEUE_CAPACITY];
+    _Alignas(64) _Atomic size_t tail;
+    _Alignas(64) _Atomic size_t head;
+    phase pushes;
+    phase pops;
+#else
+    size_t tail;
+    size_t head;
+#endif
+#if QUEUE_SYNC == QUEUE_SYNC_COND
+    pthread_mutex_t mutex;
+    pthread_cond_t not_full;
+    pthread_cond_t not_empty;
+#elif QUEUE_SYNC == QUEUE_SYNC_SEM
+    sem_t mutex;
+    sem_t empty;
+    sem_t full;
+#endif
+#ifdef QUEUE_EVENTFD
+    int ready;  // readable when a push found the queue empty
+#if QUEUE_SYNC == QUEUE_SYNC_SEM
+    _Atomic long pending;
+#endif
+#endif
+} QUEUE_NAME;
+
+static inline void QUEUE_FN(init)(QUEUE_NAME *q) {
+#if QUEUE_SYNC == QUEUE_SYNC_LOCKFREE
+    for (size_t i = 0; i < QUEUE_CAPACITY; i++)
+        atomic_init(&q->seqs[i], i);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->head, 0);
+    phase_init(&q->pushes, 0);
+    phase_init(&q->pops, 0);
+    // the queue does its own spinning
+    q->pushes.spin = q->pops.spin = 0;
+#else
+    int err;
+
+    q->tail = q->head = 0;
+#endif
+#if QUEUE_SYNC == QUEUE_SYNC_COND
+    if ((err = pthread_mutex_init(&q->mutex, NULL)) != 0)
+        fprintf(stderr, "Error in pthread_mutex_init: %d\n", err);
+    if ((err = pthread_cond_init(&q->not_full, NULL)) != 0)
+        fprintf(stderr, "Error in pthread_cond_init: %d\n", err);
+    if ((err = pthread_cond_init(&q->not_empty, NULL)) != 0)
+        fprintf(stderr, "Error in pthread_cond_init: %d\n", err);
+    LOCKPROF_NAME(&q->mutex, QUEUE_STR(QUEUE_NAME) ".mutex");
+    LOCKPROF_NAME(&q->not_full, QUEUE_STR(QUEUE_NAME) ".not_full");
+    LOCKPROF_NAME(&q->not_empty, QUEUE_STR(QUEUE_NAME) ".not_empty");
+#elif QUEUE_SYNC == QUEUE_SYNC_SEM
+    if ((err = sem_init(&q->mutex, 0, 1)) != 0)
+        fprintf(stderr, "Error in sem_init: %d\n", err);
+    if ((err = sem_init(&q->empty, 0, QUEUE_CAPACITY)) != 0)
+        fprintf(stderr, "Error in sem_init: %d\n", err);
+    if ((err = sem_init(&q->full, 0, 0)) != 0)
+        fprintf(stderr, "Error in sem_init: %d\n", err);
+    LOCKPROF_NAME(&q->mutex, QUEUE_STR(QUEUE_NAME) ".mutex");
+    LOCKPROF_NAME(&q->empty, QUEUE_STR(QUEUE_NAME) ".empty");
+    LOCKPROF_NAME(&q->full, QUEUE_STR(QUEUE_NAME) ".full");
+#endif
+#ifdef QUEUE_EVENTFD
+    if ((q->ready = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+        fprintf(stderr, "Error in eventfd: %d\n", errno);
+#if QUEUE_SYNC == QUEUE_SYNC_SEM
+    atomic_init(&q->pending, 0);
+#endif
+#endif
+}
+
+static inline void QUEUE_FN(destroy)(QUEUE_NAME *q) {
+#if QUEUE_SYNC == QUEUE_SYNC_COND
+    pthread_mutex_destroy(&q->mutex);
+    pthread_cond_destroy(&q->not_full);
+    pthread_cond_destroy(&q->not_empty);
+#elif QUEUE_SYNC == QUEUE_SYNC_SEM
+    sem_destroy(&q->mutex);
+    sem_destroy(&q->empty);
+    sem_destroy(&q->full);
+#else
+    (void)q;
+#endif
+#ifdef QUEUE_EVENTFD
+    close(q->ready);
+#endif
+}
+
+#ifdef QUEUE_EVENTFD
+// before draining the queue, so a push during the drain leaves the eventfd readable
+static inline void QUEUE_FN(ready_clear)(QUEUE_NAME *q) {
+    queue_ready_clear(q->ready);
+}
+#endif
+
+#if QUEUE_SYNC == QUEUE_SYNC_COND
+
+static inline void QUEUE_FN(lock)(QUEUE_NAME *q) {
+    int err;
+
+    TRACE_BEGIN(TRACE_WAIT, QUEUE_STR(QUEUE_NAME) ".mutex");
+    if ((err = pthread_mutex_lock(&q->mutex)) != 0)
+        fprintf(stderr, "Error in pthread_mutex_lock: %d\n", err);
+    TRACE_END(TRACE_WAIT, QUEUE_STR(QUEUE_NAME) ".mutex");
+    TRACE_BEGIN(TRACE_LOCK, QUEUE_STR(QUEUE_NAME));
+}
+
+static inline void QUEUE_FN(unlock)(QUEUE_NAME *q) {
+    int err;
+
+    TRACE_END(TRACE_LOCK, QUEUE_STR(QUEUE_NAME));
+    if ((err = pthread_mutex_unlock(&q->mutex)) != 0)
+        fprintf(stderr, "Error in pthread_mutex_unlock: %d\n", err);
+}
+
+// with the mutex held, true if the queue was empty
+static inline bool QUEUE_FN(put)(QUEUE_NAME *q, const QUEUE_FN(item) *item, void *ctx) {
+    size_t i = QUEUE_INDEX(q->tail);
+    bool was_empty = q->tail == q->head;
+    int err;
+
+    q->items[i] = *item;
+    q->tail++;
+    QUEUE_ON_PUSH(q, i, ctx);
+    (void)ctx;
+
+    if ((err = pthread_cond_signal(&q->not_empty)) != 0)
+        fprintf(stderr, "Error in pthread_cond_signal: %d\n", err);
+    return was_empty;
+}
+
+// after the unlock, the write is a system call
+static inline void QUEUE_FN(ready)(QUEUE_NAME *q, bool was_empty) {
+#ifdef QUEUE_EVENTFD
+    if (was_empty)
+        queue_ready_signal(q->ready);
+#else
+    (void)q;
+    (void)was_empty;
+#endif
+}
+
+// with the mutex held
+static inline void QUEUE_FN(take)(QUEUE_NAME *q, QUEUE_FN(item) *item, void *ctx) {
+    size_t i = QUEUE_INDEX(q->head);
+    int err;
+
+    *item = q->items[i];
+    q->head++;
+    QUEUE_ON_POP(q, i, ctx);
+    (void)ctx;
+
+    if ((err = pthread_cond_signal(&q->not_full)) != 0)
+        fprintf(stderr, "Error in pthread_cond_signal: %d\n", err);
+}
+
+static inline bool QUEUE_FN(try_push)(QUEUE_NAME *q, const QUEUE_FN(item) *item, void *ctx) {
+    bool done = false, was_empty = false;
+
+    QUEUE_FN(lock)(q);
+    if (q->tail - q->head < QUEUE_CAPACITY) {
+        was_empty = QUEUE_FN(put)(q, item, ctx);
+        done = true;
+    }
+    QUEUE_FN(unlock)(q);
+    QUEUE_FN(ready)(q, was_empty);
+    return done;
+}
+
+static inline bool QUEUE_FN(try_pop)(QUEUE_NAME *q, QUEUE_FN(item) *item, void *ctx) {
+    bool done = false;
+
+    QUEUE_FN(lock)(q);
+    if (q->tail != q->head) {
+        QUEUE_FN(take)(q, item, ctx);
+        done = true;
+    }
+    QUEUE_FN(unlock)(q);
+    return done;
+}
+
+static inline void QUEUE_FN(push)(QUEUE_NAME *q, const QUEUE_FN(item) *item, void *ctx) {
+    bool was_empty;
+    int err;
+
+#if QUEUE_WAIT != QUEUE_WAIT_BLOCK
+    for (int i = 0; QUEUE_WAIT == QUEUE_WAIT_SPIN || i < QUEUE_SPIN; i += i < QUEUE_SPIN) {
+        if (QUEUE_FN(try_push)(q, item, ctx))
+            return;
+        queue_relax(i);
+    }
+#endif
+
+    QUEUE_FN(lock)(q);
+    while (q->tail - q->head == QUEUE_CAPACITY) {
+        TRACE_BEGIN(TRACE_WAIT, QUEUE_STR(QUEUE_NAME) ".not_full");
+        if ((err = pthread_cond_wait(&q->not_full, &q->mutex)) != 0)
+            fprintf(stderr, "Error in pthread_cond_wait: %d\n", err);
+        TRACE_END(TRACE_WAIT, QUEUE_STR(QUEUE_NAME) ".not_full");
+    }
+    was_empty = QUEUE_FN(put)(q, item, ctx);
+    QUEUE_FN(unlock)(q);
+    QUEUE_FN(ready)(q, was_empty);
+}
+
+static inline void QUEUE_FN(pop)(QUEUE_NAME *q, QUEUE_FN(item) *item, void *ctx) {
+    int err;
+
+#if QUEUE_WAIT != QUEUE_WAIT_BLOCK
+    for (int i = 0; QUEUE_WAIT == QUEUE_WAIT_SPIN || i < QUEUE_SPIN; i += i < QUEUE_SPIN) {
+        if (QUEUE_FN(try_pop)(q, item, ctx))
+            return;
+        queue_relax(i);
+    }
+#endif
+
+    QUEUE_FN(lock)(q);
+    while (q->tail == q->head) {
+        TRACE_BEGIN(TRACE_WAIT, QUEUE_STR(QUEUE_NAME) ".not_empty");
+        if ((err = pthread_cond_wait(&q->not_empty, &q->mutex)) != 0)
+            fprintf(stderr, "Error in pthread_cond_wait: %d\n", err);
+        TRACE_END(TRACE_WAIT, QUEUE_STR(QUEUE_NAME) ".not_empty");
+    }
+    QUEUE_FN(take)(q, item, ctx);
+    QUEUE_FN(unlock)(q);
+}
+
+#elif QUEUE_SYNC == QUEUE_SYNC_SEM
+
+// down(sem), false if it would block and wait is false; name is for the trace
+static inline bool QUEUE_FN(down)(sem_t *sem, bool wait, const char *name) {
+    if (sem_trywait(sem) == 0)
+        return true;
+    if (!wait) {
+        LOCKPROF_GIVE_UP(sem);
+        return false;
+    }
+
+    (void)name;
+    TRACE_BEGIN(TRACE_WAIT, name);
+#if QUEUE_WAIT != QUEUE_WAIT_BLOCK
+    for (int i = 0; QUEUE_WAIT == QUEUE_WAIT_SPIN || i < QUEUE_SPIN; i += i < QUEUE_SPIN) {
+        if (sem_trywait(sem) == 0) {
+            TRACE_END(TRACE_WAIT, name);
+            return true;
+        }
+        queue_relax(i);
+    }
+#endif
+    while (sem_wait(sem) != 0)
+        ;  // interrupted by a signal
+    TRACE_END(TRACE_WAIT, name);
+    return true;
+}
+
+static inline void QUEUE_FN(up)(sem_t *sem) {
+    if (sem_post(sem) != 0)
+        fprintf(stderr, "Error in sem_post\n");
+}
+
+// after down(empty)
+static inline void QUEUE_FN(put)(QUEUE_NAME *q, const QUEUE_FN(item) *item, void *ctx) {
+    size_t i;
+
+    QUEUE_FN(down)(&q->mutex, true, QUEUE_STR(QUEUE_NAME) ".mutex");
+    TRACE_BEGIN(TRACE_LOCK, QUEUE_STR(QUEUE_NAME));
+    i = QUEUE_INDEX(q->tail);
+    q->items[i] = *item;
+    q->tail++;
+    QUEUE_ON_PUSH(q, i, ctx);
+    (void)ctx;
+    TRACE_END(TRACE_LOCK, QUEUE_STR(QUEUE_NAME));
+    QUEUE_FN(up)(&q->mutex);
+
+    QUEUE_FN(up)(&q->full);
+#ifdef QUEUE_EVENTFD
+    // the consumers see an empty queue in down(full), not in head and tail: pending counts the
+    // ups of full not yet taken by a down, and a push that finds none signals. Otherwise the
+    // consumer that takes the earlier item does down(full) again after this up
+    if (atomic_fetch_add(&q->pending, 1) <= 0)
+        queue_ready_signal(q->ready);
+#endif
+}
+
+// after down(full)
+static inline void QUEUE_FN(take)(QUEUE_NAME *q, QUEUE_FN(item) *item, void *ctx) {
+    size_t i;
+
+#ifdef QUEUE_EVENTFD
+    atomic_fetch_sub(&q->pending, 1);
+#endif
+    QUEUE_FN(down)(&q->mutex, true, QUEUE_STR(QUEUE_NAME) ".mutex");
+    TRACE_BEGIN(TRACE_LOCK, QUEUE_STR(QUEUE_NAME));
+    i = QUEUE_INDEX(q->head);
+    *item = q->items[i];
+    q->head++;
+    QUEUE_ON_POP(q, i, ctx);
+    (void)ctx;
+    TRACE_END(TRACE_LOCK, QUEUE_STR(QUEUE_NAME));
+    QUEUE_FN(up)(&q->mutex);
+
+    QUEUE_FN(up)(&q->empty);
+}
+
+static inline bool QUEUE_FN(try_push)(QUEUE_NAME *q, const QUEUE_FN(item) *item, void *ctx) {
+    if (!QUEUE_FN(down)(&q->empty, false, NULL))
+        return false;
+    QUEUE_FN(put)(q, item, ctx);
+    return true;
+}
+
+static inline bool QUEUE_FN(try_pop)(QUEUE_NAME *q, QUEUE_FN(item) *item, void *ctx) {
+    if (!QUEUE_FN(down)(&q->full, false, NULL))
+        return false;
+    QUEUE_FN(take)(q, item, ctx);
+    return true;
+}
+
+static inline void QUEUE_FN(push)(QUEUE_NAME *q, const QUEUE_FN(item) *item, void *ctx) {
+    QUEUE_FN(down)(&q->empty, true, QUEUE_STR(QUEUE_NAME) ".empty");
+    QUEUE_FN(put)(q, item, ctx);
+}
+
+static inline void QUEUE_FN(pop)(QUEUE_NAME *q, QUEUE_FN(item) *item, void *ctx) {
+    QUEUE_FN(down)(&q->full, true, QUEUE_STR(QUEUE_NAME) ".full");
+    QUEUE_FN(take)(q, item, ctx);
+}
+
+#elif QUEUE_SYNC == QUEUE_SYNC_LOCKFREE
+
+static inline bool QUEUE_FN(try_push)(QUEUE_NAME *q, const QUEUE_FN(item) *item, void *ctx) {
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t i, seq;
+
+    while (1) {
+        i = QUEUE_INDEX(pos);
+        seq = atomic_load_explicit(&q->seqs[i], memory_order_acquire);
+        if (seq == pos) {
+            // the slot is free for this position, claim it
+            if (atomic_compare_exchange_weak_explicit(&q->tail, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        }
+        else if ((ptrdiff_t)(seq - pos) < 0)
+            return false;  // the slot still holds the item of the previous lap
+        else
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    }
+
+    q->items[i] = *item;
+    QUEUE_ON_PUSH(q, i, ctx);
+    (void)ctx;
+    atomic_store_explicit(&q->seqs[i], pos + 1, memory_order_release);
+
+    phase_add(&q->pushes, 1, PHASE_ALL);
+#ifdef QUEUE_EVENTFD
+    // head == pos: the earlier items have been popped and this one has not, the queue was
+    // empty. A greater head is a consumer still draining, a smaller one an earlier item whose
+    // pusher signals when it sees head at its own position. The fence pairs with the one in
+    // try_pop: either this load sees the pop of the item before, or that pop sees this item.
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&q->head, memory_order_relaxed) == pos)
+        queue_ready_signal(q->ready);
+#endif
+    return true;
+}
+
+static inline bool QUEUE_FN(try_pop)(QUEUE_NAME *q, QUEUE_FN(item) *item, void *ctx) {
+    size_t pos, i, seq;
+
+#ifdef QUEUE_EVENTFD
+    atomic_thread_fence(memory_order_seq_cst);
+#endif
+    pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+
+    while (1) {
+        i = QUEUE_INDEX(pos);
+        seq = atomic_load_explicit(&q->seqs[i], memory_order_acquire);
+        if (seq == pos + 1) {
+            // the slot holds the item for this position, claim it
+            if (atomic_compare_exchange_weak_explicit(&q->head, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        }
+        else if ((ptrdiff_t)(seq - (pos + 1)) < 0)
+            return false;  // the item has not been pushed yet
+        else
+            pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    }
+
+    *item = q->items[i];
+    QUEUE_ON_POP(q, i, ctx);
+    (void)ctx;
+    atomic_store_explicit(&q->seqs[i], pos + QUEUE_CAPACITY, memory_order_release);
+
+    phase_add(&q->pops, 1, PHASE_ALL);
+    return true;
+}
+
+static inline void QUEUE_FN(push)(QUEUE_NAME *q, const QUEUE_FN(item) *item, void *ctx) {
+    uint32_t pops;
+
+    for (int i = 0;; i += i < QUEUE_SPIN) {
+        // a pop after this load changes the phase word, so the wait below does not miss it
+        pops = phase_load(&q->pops);
+        if (QUEUE_FN(try_push)(q, item, ctx))
+            return;
+        if (QUEUE_WAIT == QUEUE_WAIT_SPIN || (QUEUE_WAIT == QUEUE_WAIT_ADAPTIVE && i < QUEUE_SPIN))
+            queue_relax(i);
+        else {
+            TRACE_BEGIN(TRACE_WAIT, QUEUE_STR(QUEUE_NAME) ".pops");
+            phase_wait(&q->pops, pops, PHASE_ALL);
+            TRACE_END(TRACE_WAIT, QUEUE_STR(QUEUE_NAME) ".pops");
+        }
+    }
+}
+
+static inline void QUEUE_FN(pop)(QUEUE_NAME *q, QUEUE_FN(item) *item, void *ctx) {
+    uint32_t pushes;
+
+    for (int i = 0;; i += i < QUEUE_SPIN) {
+        pushes = phase_load(&q->pushes);
+        if (QUEUE_FN(try_pop)(q, item, ctx))
+            return;
+        if (QUEUE_WAIT == QUEUE_WAIT_SPIN || (QUEUE_WAIT == QUEUE_WAIT_ADAPTIVE && i < QUEUE_SPIN))
+            queue_relax(i);
+        else {
+            TRACE_BEGIN(TRACE_WAIT, QUEUE_STR(QUEUE_NAME) ".pushes");
+            phase_wait(&q->pushes, pushes, PHASE_ALL);
+            TRACE_END(TRACE_WAIT, QUEUE_STR(QUEUE_NAME) ".pushes");
+        }
+    }
+}
+
+#else
+#error "Unknown QUEUE_SYNC"
+#endif
+
+#undef QUEUE_FN
+#undef QUEUE_INDEX
+#undef QUEUE_NAME
+#undef QUEUE_TYPE
+#undef QUEUE_CAPACITY
+#undef QUEUE_SYNC
+#undef QUEUE_WAIT
+#undef QUEUE_ON_PUSH
+#undef QUEUE_ON_POP
+#undef QUEUE_EVENTFD
@@ -0,0 +1,250 @@
+/**
+ * Coroutines: stackless tasks run by a few worker threads (M:N), so a program can have
+ * hundreds of thousands of logical threads at the cost of a struct each.
+ * A task is a struct whose first member is a coro_task, and a function that resumes it:
+ *     coro_status producer(coro_task *t) {
+ *         producer_data *p = (producer_data *)t;
+ *         CORO_BEGIN(t);
+ *         while (...)
+ *             CORO_AWAIT(t, chan_push(&p->shared->chan, p));
+ *         CORO_END(t);
+ *     }
+ * The resume point is a case label (the protothreads' switch), so a suspension costs a
+ * return and a resume a call: the local variables do not survive a CORO_YIELD or a
+ * CORO_AWAIT, what the task needs goes in its struct, and the body must not use a switch
+ * around them nor put two of them on a line. CORO_AWAIT(t, op) evaluates op, which returns true if it completed at once;
+ * otherwise op has parked the task on a wait list and who completes it later calls
+ * coro_wake(sched, t), so the task goes on after CORO_AWAIT with the operation done.
+ * Every worker has its own run queue; a woken task goes in the queue of the worker that woke
+ * it, an idle worker steals half of the tasks of another one, and sleeps on a phase word
+ * (phase.h) when there are none. coro_sched_run returns when all the tasks have ended.
+ * With -DTRACE_EVENTS (trace.h) the idle waits of the workers are traced.
+*/
+
+#ifndef CORO_H
+#define CORO_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "phase.h"
+#include "trace.h"
+
+typedef enum { CORO_DONE, CORO_YIELDED, CORO_SUSPENDED } coro_status;
+
+typedef struct coro_task {
+    struct coro_task *next;  // in a run queue or in a wait list
+    coro_status (*resume)(struct coro_task *);
+    int state;  // the line of the resume point, 0 at the start
+} coro_task;
+
+#define CORO_BEGIN(t) switch ((t)->state) { case 0:
+#define CORO_END(t) } (t)->state = -1; return CORO_DONE
+#define CORO_YIELD(t) do { (t)->state = __LINE__; return CORO_YIELDED; case __LINE__:; } while (0)
+#define CORO_AWAIT(t, op) do { \
+    (t)->state = __LINE__; \
+    if (!(op)) \
+        return CORO_SUSPENDED; \
+    __attribute__((fallthrough)); \
+    case __LINE__:; \
+} while (0)
+
+typedef struct {
+    coro_task *head;
+    coro_task *tail;
+} coro_list;
+
+static inline void coro_list_push(coro_list *l, coro_task *t) {
+    t->next = NULL;
+    if (l->tail == NULL)
+        l->head = t;
+    else
+        l->tail->next = t;
+    l->tail = t;
+}
+
+static inline coro_task *coro_list_pop(coro_list *l) {
+    coro_task *t = l->head;
+
+    if (t != NULL && (l->head = t->next) == NULL)
+        l->tail = NULL;
+    return t;
+}
+
+struct coro_sched;
+
+typedef struct {
+    _Alignas(64) pthread_mutex_t mutex;  // of the run queue, taken by the thieves too
+    coro_list runq;
+    long length;
+
+    pthread_t tid;
+    int worker_i;
+    struct coro_sched *sched;
+    long resumes;
+    long suspensions;
+    long steals;
+} coro_worker;
+
+typedef struct coro_sched {
+    coro_worker *workers;
+    int workers_num;
+    _Atomic long live;  // tasks not ended
+    _Atomic int next_worker;  // of coro_spawn from outside the workers
+    phase work;  // advanced when a task becomes runnable and when the last one ends
+} coro_sched;
+
+static __thread coro_worker *coro_self;
+
+static inline void coro_runq_push(coro_worker *w, coro_task *t) {
+    pthread_mutex_lock(&w->mutex);
+    coro_list_push(&w->runq, t);
+    w->length++;
+    pthread_mutex_unlock(&w->mutex);
+}
+
+static inline coro_task *coro_runq_pop(coro_worker *w) {
+    coro_task *t;
+
+    pthread_mutex_lock(&w->mutex);
+    if ((t = coro_list_pop(&w->runq)) != NULL)
+        w->length--;
+    pthread_mutex_unlock(&w->mutex);
+    return t;
+}
+
+// moves half of the tasks of another worker to w, returns one of them
+static coro_task *coro_steal(coro_worker *w) {
+    coro_sched *s = w->sched;
+    coro_list stolen = {NULL, NULL};
+    coro_task *t;
+    long n = 0;
+
+    for (int i = 1; i < s->workers_num && n == 0; i++) {
+        coro_worker *victim = &s->workers[(w->worker_i - 1 + i) % s->workers_num];
+        pthread_mutex_lock(&victim->mutex);
+        n = (victim->length + 1) / 2;
+        for (long k = 0; k < n; k++)
+            coro_list_push(&stolen, coro_list_pop(&victim->runq));
+        victim->length -= n;
+        pthread_mutex_unlock(&victim->mutex);
+    }
+    if (n == 0)
+        return NULL;
+
+    w->steals++;
+    t = coro_list_pop(&stolen);
+    pthread_mutex_lock(&w->mutex);
+    while (stolen.head != NULL) {
+        coro_list_push(&w->runq, coro_list_pop(&stolen));
+        w->length++;
+    }
+    pthread_mutex_unlock(&w->mutex);
+    return t;
+}
+
+// makes a parked task runnable, on the worker of the caller
+static inline void coro_wake(coro_sched *s, coro_task *t) {
+    coro_worker *w = coro_self != NULL ? coro_self : &s->workers[0];
+
+    coro_runq_push(w, t);
+    phase_add(&s->work, 1, PHASE_ALL);
+}
+
+static inline void coro_spawn(coro_sched *s, coro_task *t, coro_status (*resume)(coro_task *)) {
+    coro_worker *w = coro_self;
+
+    t->resume = resume;
+    t->state = 0;
+    atomic_fetch_add(&s->live, 1);
+    // outside the workers the tasks are dealt round robin
+    if (w == NULL)
+        w = &s->workers[atomic_fetch_add(&s->next_worker, 1) % s->workers_num];
+    coro_runq_push(w, t);
+    phase_add(&s->work, 1, PHASE_ALL);
+}
+
+static void coro_worker_loop(void *arg) {
+    coro_worker *w = (coro_worker *)arg;
+    coro_sched *s = w->sched;
+    coro_task *t;
+    uint32_t seen;
+
+    coro_self = w;
+    TRACE_THREAD("worker %d", w->worker_i);
+
+    while (1) {
+        // the value is read before looking for a task, so a wake-up after the look is not lost
+        seen = phase_load(&s->work);
+        if ((t = coro_runq_pop(w)) == NULL && (t = coro_steal(w)) == NULL) {
+            if (atomic_load(&s->live) == 0)
+                break;
+            TRACE_BEGIN(TRACE_WAIT, "idle");
+            phase_wait(&s->work, seen, PHASE_ALL);
+            TRACE_END(TRACE_WAIT, "idle");
+            continue;
+        }
+
+        // a suspended task may already be running on another worker, it is not touched again
+        w->resumes++;
+        switch (t->resume(t)) {
+        case CORO_DONE:
+            if (atomic_fetch_sub(&s->live, 1) == 1)
+                phase_add(&s->work, 1, PHASE_ALL);
+            break;
+        case CORO_YIELDED:
+            coro_runq_push(w, t);
+            break;
+        case CORO_SUSPENDED:
+            w->suspensions++;
+            break;
+        }
+    }
+
+    coro_self = NULL;
+}
+
+static void coro_sched_init(coro_sched *s, int workers_num) {
+    s->workers = aligned_alloc(64, workers_num * sizeof(coro_worker));
+    memset(s->workers, 0, workers_num * sizeof(coro_worker));
+    s->workers_num = workers_num;
+    atomic_init(&s->live, 0);
+    atomic_init(&s->next_worker, 0);
+    phase_init(&s->work, 0);
+
+    for (int i = 0; i < workers_num; i++) {
+        pthread_mutex_init(&s->workers[i].mutex, NULL);
+        s->workers[i].worker_i = i + 1;
+        s->workers[i].sched = s;
+    }
+}
+
+static void coro_sched_destroy(coro_sched *s) {
+    for (int i = 0; i < s->workers_num; i++)
+        pthread_mutex_destroy(&s->workers[i].mutex);
+    free(s->workers);
+}
+
+// runs the spawned tasks, and the ones they spawn, until all of them have ended
+static void coro_sched_run(coro_sched *s) {
+    int err;
+
+    for (int i = 0; i < s->workers_num; i++) {
+        if ((err = pthread_create(&s->workers[i].tid, NULL, (void *)coro_worker_loop, &s->workers[i])) != 0) {
+            fprintf(stderr, "Error in pthread_create: %d\n", err);
+            exit(1);
+        }
+    }
+    for (int i = 0; i < s->workers_num; i++) {
+        if ((err = pthread_join(s->workers[i].tid, NULL)) != 0) {
+            fprintf(stderr, "Error in pthread_join: %d\n", err);
+            exit(1);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,302 @@
+/**
+ * Lock profiler: built with -DLOCKPROF, pthread_mutex_lock, pthread_mutex_unlock,
+ * pthread_cond_wait, sem_wait and sem_trywait are replaced by wrappers that count, for every
+ * mutex, condition var and semaphore, the acquisitions and the contended ones (the lock was
+ * busy, the semaphore was zero) with the histograms of the wait time and, for the mutexes, of
+ * the hold time. A failed sem_trywait is not an acquisition: the next acquisition of the
+ * semaphore by the same thread is the contended one, with the wait from the first failed try,
+ * unless the thread gives up on it with LOCKPROF_GIVE_UP(sem) in between.
+ * The role of a lock is its expression in the source, such as sh->mutex or sh->cond[JUDGE];
+ * the locks with the same role are reported together, at exit, on the standard error, the
+ * most waited for first.
+ * A lock hidden behind a helper function can be named with LOCKPROF_NAME(lock, role) after
+ * its init. Without LOCKPROF the header defines LOCKPROF_NAME and LOCKPROF_GIVE_UP as no-ops.
+ * It must be included after the system headers and before the headers whose locks are to be
+ * profiled.
+*/
+
+#ifndef LOCKPROF_H
+#define LOCKPROF_H
+
+#ifdef LOCKPROF
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#ifndef LOCKPROF_SLOTS
+#define LOCKPROF_SLOTS 1024  // locks profiled, a power of two
+#endif
+
+// bucket i holds the times in [2^(i-1), 2^i) ns
+#define LOCKPROF_BUCKETS 40
+
+typedef enum { LOCKPROF_MUTEX, LOCKPROF_COND, LOCKPROF_SEM } lockprof_kind;
+
+static const char *const lockprof_kinds[] = {"mutex", "cond", "sem"};
+
+typedef struct {
+    _Atomic(const void *) lock;
+    _Atomic(const char *) role;
+    lockprof_kind kind;
+
+    _Atomic uint64_t acquires;
+    _Atomic uint64_t contended;
+    _Atomic uint64_t wait_ns;
+    _Atomic uint64_t hold_ns;
+    _Atomic uint64_t wait_hist[LOCKPROF_BUCKETS];
+    _Atomic uint64_t hold_hist[LOCKPROF_BUCKETS];
+
+    uint64_t locked_at;  // written by the holder of the mutex
+} lockprof_entry;
+
+static lockprof_entry lockprof_table[LOCKPROF_SLOTS];
+static pthread_once_t lockprof_once = PTHREAD_ONCE_INIT;
+
+static inline uint64_t lockprof_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static inline int lockprof_bucket(uint64_t ns) {
+    int b = ns == 0 ? 0 : 64 - __builtin_clzll(ns);
+
+    return b < LOCKPROF_BUCKETS ? b : LOCKPROF_BUCKETS - 1;
+}
+
+// upper bound of the bucket of the p-th fraction of the samples
+static uint64_t lockprof_percentile(const _Atomic uint64_t *hist, uint64_t n, double p) {
+    uint64_t seen = 0;
+
+    for (int b = 0; b < LOCKPROF_BUCKETS; b++) {
+        seen += atomic_load_explicit(&hist[b], memory_order_relaxed);
+        if (seen > 0 && seen >= p * n)
+            return b == 0 ? 0 : 1ull << b;
+    }
+    return 0;
+}
+
+static int lockprof_compare(const void *a, const void *b) {
+    uint64_t x = ((const lockprof_entry *)a)->wait_ns, y = ((const lockprof_entry *)b)->wait_ns;
+
+    return (x < y) - (x > y);
+}
+
+static void lockprof_add(lockprof_entry *to, const lockprof_entry *from) {
+    to->acquires += from->acquires;
+    to->contended += from->contended;
+    to->wait_ns += from->wait_ns;
+    to->hold_ns += from->hold_ns;
+    for (int b = 0; b < LOCKPROF_BUCKETS; b++) {
+        to->wait_hist[b] += from->wait_hist[b];
+        to->hold_hist[b] += from->hold_hist[b];
+    }
+}
+
+static void lockprof_report(void) {
+    lockprof_entry *roles = calloc(LOCKPROF_SLOTS, sizeof(lockprof_entry));
+    const char *role;
+    int roles_num = 0, r;
+
+    // merge the locks with the same role
+    for (int i = 0; i < LOCKPROF_SLOTS; i++) {
+        if ((role = atomic_load(&lockprof_table[i].role)) == NULL)
+            continue;
+        for (r = 0; r < roles_num; r++) {
+            if (roles[r].kind == lockprof_table[i].kind && strcmp(roles[r].role, role) == 0)
+                break;
+        }
+        if (r == roles_num) {
+            roles[r].role = role;
+            roles[r].kind = lockprof_table[i].kind;
+            roles_num++;
+        }
+        lockprof_add(&roles[r], &lockprof_table[i]);
+    }
+    qsort(roles, roles_num, sizeof(lockprof_entry), lockprof_compare);
+
+    fprintf(stderr, "\n%-32s %-5s %12s %12s %7s %12s %10s %10s %12s %10s %10s\n", "lock", "kind", "acquires",
+            "contended", "%", "wait ms", "wait p50", "wait p99", "hold ms", "hold p50", "hold p99");
+    for (r = 0; r < roles_num; r++) {
+        lockprof_entry *e = &roles[r];
+        fprintf(stderr, "%-32s %-5s %12lu %12lu %6.1f%% %12.3f %10lu %10lu", e->role, lockprof_kinds[e->kind],
+                (unsigned long)e->acquires, (unsigned long)e->contended,
+                e->acquires > 0 ? 100.0 * e->contended / e->acquires : 0.0, e->wait_ns / 1e6,
+                (unsigned long)lockprof_percentile(e->wait_hist, e->acquires, 0.5),
+                (unsigned long)lockprof_percentile(e->wait_hist, e->acquires, 0.99));
+        if (e->kind == LOCKPROF_MUTEX)
+            fprintf(stderr, " %12.3f %10lu %10lu\n", e->hold_ns / 1e6,
+                    (unsigned long)lockprof_percentile(e->hold_hist, e->acquires, 0.5),
+                    (unsigned long)lockprof_percentile(e->hold_hist, e->acquires, 0.99));
+        else
+            fprintf(stderr, " %12s %10s %10s\n", "-", "-", "-");
+    }
+
+    free(roles);
+}
+
+static void lockprof_init(void) {
+    atexit(lockprof_report);
+}
+
+static lockprof_entry *lockprof_entry_of(const void *lock, const char *role, lockprof_kind kind) {
+    uintptr_t h = ((uintptr_t)lock >> 3) * 0x9E3779B97F4A7C15ull;
+    const void *found;
+
+    pthread_once(&lockprof_once, lockprof_init);
+
+    for (int i = 0; i < LOCKPROF_SLOTS; i++) {
+        lockprof_entry *e = &lockprof_table[(h + i) & (LOCKPROF_SLOTS - 1)];
+        found = atomic_load_explicit(&e->lock, memory_order_acquire);
+        if (found == NULL) {
+            if (atomic_compare_exchange_strong(&e->lock, &found, lock)) {
+                e->kind = kind;
+                // the role is the expression, without the address-of
+                atomic_store(&e->role, role[0] == '&' ? role + 1 : role);
+                return e;
+            }
+        }
+        if (found == lock)
+            return e;
+    }
+
+    // too many locks, they share the last slot
+    return &lockprof_table[LOCKPROF_SLOTS - 1];
+}
+
+static inline void lockprof_wait(lockprof_entry *e, bool contended, uint64_t wait) {
+    atomic_fetch_add_explicit(&e->acquires, 1, memory_order_relaxed);
+    if (contended) {
+        atomic_fetch_add_explicit(&e->contended, 1, memory_order_relaxed);
+        atomic_fetch_add_explicit(&e->wait_ns, wait, memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&e->wait_hist[lockprof_bucket(wait)], 1, memory_order_relaxed);
+}
+
+static inline int lockprof_mutex_lock(pthread_mutex_t *m, const char *role) {
+    lockprof_entry *e = lockprof_entry_of(m, role, LOCKPROF_MUTEX);
+    uint64_t start;
+    int err;
+
+    if ((err = pthread_mutex_trylock(m)) == 0)
+        lockprof_wait(e, false, 0);
+    else {
+        start = lockprof_now();
+        if ((err = pthread_mutex_lock(m)) != 0)
+            return err;
+        lockprof_wait(e, true, lockprof_now() - start);
+    }
+    e->locked_at = lockprof_now();
+    return 0;
+}
+
+static inline void lockprof_release(pthread_mutex_t *m) {
+    lockprof_entry *e = lockprof_entry_of(m, "", LOCKPROF_MUTEX);
+    uint64_t hold = lockprof_now() - e->locked_at;
+
+    atomic_fetch_add_explicit(&e->hold_ns, hold, memory_order_relaxed);
+    atomic_fetch_add_explicit(&e->hold_hist[lockprof_bucket(hold)], 1, memory_order_relaxed);
+}
+
+static inline int lockprof_mutex_unlock(pthread_mutex_t *m) {
+    lockprof_release(m);
+    return pthread_mutex_unlock(m);
+}
+
+// the mutex is released during the wait, its hold time restarts when it is taken back
+static inline int lockprof_cond_wait(pthread_cond_t *c, pthread_mutex_t *m, const char *role) {
+    lockprof_entry *e = lockprof_entry_of(c, role, LOCKPROF_COND);
+    uint64_t start;
+    int err;
+
+    lockprof_release(m);
+    start = lockprof_now();
+    err = pthread_cond_wait(c, m);
+    lockprof_wait(e, true, lockprof_now() - start);
+    lockprof_entry_of(m, "", LOCKPROF_MUTEX)->locked_at = lockprof_now();
+    return err;
+}
+
+// the semaphore whose last sem_trywait by this thread failed, and when: a later acquisition
+// of it is a contended one, with the wait from that try
+static __thread const sem_t *lockprof_tried;
+static __thread uint64_t lockprof_tried_at;
+
+// the wait start of an acquisition of s, 0 if it is not contended so far
+static inline uint64_t lockprof_tried_take(sem_t *s) {
+    uint64_t start = lockprof_tried == s ? lockprof_tried_at : 0;
+
+    lockprof_tried = NULL;
+    return start;
+}
+
+static inline int lockprof_sem_wait(sem_t *s, const char *role) {
+    lockprof_entry *e = lockprof_entry_of(s, role, LOCKPROF_SEM);
+    uint64_t start = lockprof_tried_take(s);
+    int err;
+
+    if (sem_trywait(s) == 0) {
+        lockprof_wait(e, start != 0, start != 0 ? lockprof_now() - start : 0);
+        return 0;
+    }
+    if (start == 0)
+        start = lockprof_now();
+    if ((err = sem_wait(s)) == 0)
+        lockprof_wait(e, true, lockprof_now() - start);
+    return err;
+}
+
+// a failed try is not counted: it is a wait only if the thread goes on until it acquires
+static inline int lockprof_sem_trywait(sem_t *s, const char *role) {
+    lockprof_entry *e = lockprof_entry_of(s, role, LOCKPROF_SEM);
+    uint64_t start;
+    int err;
+
+    if ((err = sem_trywait(s)) == 0) {
+        start = lockprof_tried_take(s);
+        lockprof_wait(e, start != 0, start != 0 ? lockprof_now() - start : 0);
+    } else if (errno == EAGAIN && lockprof_tried != s) {
+        lockprof_tried = s;
+        lockprof_tried_at = lockprof_now();
+        errno = EAGAIN;
+    }
+    return err;
+}
+
+// the thread does not wait for s after its failed tries
+static inline void lockprof_give_up(sem_t *s) {
+    if (lockprof_tried == s)
+        lockprof_tried = NULL;
+}
+
+static inline void lockprof_name(const void *lock, const char *role, lockprof_kind kind) {
+    atomic_store(&lockprof_entry_of(lock, role, kind)->role, role);
+}
+
+#define pthread_mutex_lock(m) lockprof_mutex_lock((m), #m)
+#define pthread_mutex_unlock(m) lockprof_mutex_unlock(m)
+#define pthread_cond_wait(c, m) lockprof_cond_wait((c), (m), #c)
+#define sem_wait(s) lockprof_sem_wait((s), #s)
+#define sem_trywait(s) lockprof_sem_trywait((s), #s)
+
+#define LOCKPROF_NAME(lock, role) lockprof_name((lock), (role), _Generic((lock), \
+    pthread_mutex_t *: LOCKPROF_MUTEX, pthread_cond_t *: LOCKPROF_COND, sem_t *: LOCKPROF_SEM))
+#define LOCKPROF_GIVE_UP(sem) lockprof_give_up(sem)
+
+#else
+
+#define LOCKPROF_NAME(lock, role) ((void)0)
+#define LOCKPROF_GIVE_UP(sem) ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,320 @@
+/**
+ * Self-profiling with the hardware counters: built with -DPERFCOUNT, every thread that calls
+ * PERF_THREAD(role) opens a group of counters with perf_event_open (cycles, instructions, cache
+ * misses, branch misses and context switches), and PERF_BEGIN(region) and
+ * PERF_END(region) read the group around a named region of its code. The regions can be
+ * nested; region is a string literal. When the thread exits its counts are added to the ones
+ * of its role, so PERF_REPORT(), after the threads are joined, prints on the standard error a
+ * table with a row per role and region, plus a "(thread)" row with the whole life of the threads.
+ * The counters the kernel does not allow (perf_event_paranoid, containers, virtual machines)
+ * are reported once and shown as "-"; the calls, the wall time and the CPU time of the thread
+ * are always measured. The counters of a thread count only that thread, not the kernel for the
+ * hardware ones. Without PERFCOUNT the macros do nothing.
+*/
+
+#ifndef PERFCOUNT_H
+#define PERFCOUNT_H
+
+#ifdef PERFCOUNT
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#ifndef PERF_REGIONS
+#define PERF_REGIONS 16  // regions per thread
+#endif
+#define PERF_DEPTH 8  // nested regions
+#define PERF_ROWS 256  // role and region pairs in the report
+
+typedef enum { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_CACHE_MISSES, PERF_BRANCH_MISSES, PERF_CONTEXT_SWITCHES,
+               PERF_EVENTS } perf_event;
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+} perf_events[PERF_EVENTS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, "cycles"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, "instructions"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, "cache-misses"},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, "branch-misses"},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context-switches"},
+};
+
+// a reading of the group, the counts are scaled when the kernel multiplexed the counters
+typedef struct {
+    uint64_t ns, cpu_ns;
+    uint64_t enabled, running;
+    uint64_t counts[PERF_EVENTS];
+} perf_sample;
+
+typedef struct {
+    const char *role;
+    const char *region;
+    long calls;
+    uint64_t ns, cpu_ns;
+    double counts[PERF_EVENTS];
+} perf_row;
+
+typedef struct {
+    const char *role;
+    int leader;  // -1 without counters
+    int fds[PERF_EVENTS];
+    int index[PERF_EVENTS];  // position in the group, -1 if not opened
+    int nr;
+
+    perf_sample start;
+    perf_sample stack[PERF_DEPTH];
+    int depth;
+    perf_row regions[PERF_REGIONS];
+    int regions_num;
+} perf_thread;
+
+static __thread perf_thread *perf_self;
+
+static pthread_once_t perf_once = PTHREAD_ONCE_INIT;
+static pthread_key_t perf_key;
+static pthread_mutex_t perf_mutex = PTHREAD_MUTEX_INITIALIZER;
+static perf_row perf_rows[PERF_ROWS];
+static int perf_rows_num;
+static bool perf_opened[PERF_EVENTS];  // by at least one thread
+static bool perf_warned;
+
+static inline uint64_t perf_now(clockid_t clock) {
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void perf_read(perf_thread *t, perf_sample *s) {
+    struct {
+        uint64_t nr, enabled, running;
+        uint64_t values[PERF_EVENTS];
+    } data;
+
+    s->ns = perf_now(CLOCK_MONOTONIC);
+    s->cpu_ns = perf_now(CLOCK_THREAD_CPUTIME_ID);
+    if (t->leader < 0 || read(t->leader, &data, sizeof(data)) <= 0)
+        return;
+    s->enabled = data.enabled;
+    s->running = data.running;
+    for (int e = 0; e < PERF_EVENTS; e++)
+        s->counts[e] = t->index[e] >= 0 ? data.values[t->index[e]] : 0;
+}
+
+// adds the counts between from and to to the row
+static void perf_add(perf_row *r, const perf_sample *from, const perf_sample *to) {
+    uint64_t enabled = to->enabled - from->enabled, running = to->running - from->running;
+    double scale = running > 0 && running < enabled ? (double)enabled / running : 1.0;
+
+    r->calls++;
+    r->ns += to->ns - from->ns;
+    r->cpu_ns += to->cpu_ns - from->cpu_ns;
+    for (int e = 0; e < PERF_EVENTS; e++)
+        r->counts[e] += (to->counts[e] - from->counts[e]) * scale;
+}
+
+static void perf_merge(const perf_row *r) {
+    int i;
+
+    for (i = 0; i < perf_rows_num; i++) {
+        if (strcmp(perf_rows[i].role, r->role) == 0 && strcmp(perf_rows[i].region, r->region) == 0)
+            break;
+    }
+    if (i == perf_rows_num) {
+        if (perf_rows_num == PERF_ROWS)
+            return;
+        perf_rows[i] = (perf_row){r->role, r->region, 0, 0, 0, {0}};
+        perf_rows_num++;
+    }
+    perf_rows[i].calls += r->calls;
+    perf_rows[i].ns += r->ns;
+    perf_rows[i].cpu_ns += r->cpu_ns;
+    for (int e = 0; e < PERF_EVENTS; e++)
+        perf_rows[i].counts[e] += r->counts[e];
+}
+
+// at the exit of the thread, its regions go to the rows of its role
+static void perf_thread_exit(void *arg) {
+    perf_thread *t = (perf_thread *)arg;
+    perf_row life = {t->role, "(thread)", 0, 0, 0, {0}};
+    perf_sample end = t->start;
+
+    perf_read(t, &end);
+    perf_add(&life, &t->start, &end);
+
+    pthread_mutex_lock(&perf_mutex);
+    perf_merge(&life);
+    for (int i = 0; i < t->regions_num; i++) {
+        t->regions[i].role = t->role;
+        perf_merge(&t->regions[i]);
+    }
+    pthread_mutex_unlock(&perf_mutex);
+
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        if (t->fds[e] >= 0)
+            close(t->fds[e]);
+    }
+    free(t);
+    perf_self = NULL;
+}
+
+static void perf_init(void) {
+    if (pthread_key_create(&perf_key, perf_thread_exit) != 0)
+        fprintf(stderr, "Error in pthread_key_create\n");
+}
+
+static int perf_open(perf_event e, int group) {
+    struct perf_event_attr attr;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = perf_events[e].type;
+    attr.config = perf_events[e].config;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    attr.exclude_hv = 1;
+    // the context switches happen in the kernel
+    attr.exclude_kernel = attr.type == PERF_TYPE_HARDWARE;
+
+    fd = syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+    if (fd < 0 && (errno == EACCES || errno == EPERM) && !attr.exclude_kernel) {
+        attr.exclude_kernel = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+    }
+    return fd;
+}
+
+// opens the counters of the calling thread, once
+static void perf_thread_start(const char *role) {
+    perf_thread *t;
+    char missing[256] = "";
+    int fd, err = 0;
+
+    if (perf_self != NULL)
+        return;
+    pthread_once(&perf_once, perf_init);
+    if ((t = calloc(1, sizeof(perf_thread))) == NULL)
+        return;
+
+    t->role = role;
+    t->leader = -1;
+    for (int e = 0; e < PERF_EVENTS; e++) {
+        t->index[e] = t->fds[e] = -1;
+        if ((fd = perf_open(e, t->leader)) < 0) {
+            err = errno;
+            strcat(missing, " ");
+            strcat(missing, perf_events[e].name);
+            continue;
+        }
+        // the other counters are read through the leader
+        if (t->leader < 0)
+            t->leader = fd;
+        t->fds[e] = fd;
+        t->index[e] = t->nr++;
+    }
+
+    pthread_mutex_lock(&perf_mutex);
+    for (int e = 0; e < PERF_EVENTS; e++)
+        perf_opened[e] |= t->index[e] >= 0;
+    if (missing[0] != '\0' && !perf_warned) {
+        fprintf(stderr, "perfcount: counters not available:%s (%s), see /proc/sys/kernel/perf_event_paranoid\n",
+                missing, strerror(err));
+        perf_warned = true;
+    }
+    pthread_mutex_unlock(&perf_mutex);
+
+    perf_read(t, &t->start);
+    perf_self = t;
+    if (pthread_setspecific(perf_key, t) != 0)
+        fprintf(stderr, "Error in pthread_setspecific\n");
+}
+
+static inline void perf_begin(const char *region) {
+    perf_thread *t = perf_self;
+
+    (void)region;
+    if (t == NULL || t->depth == PERF_DEPTH)
+        return;
+    perf_read(t, &t->stack[t->depth++]);
+}
+
+static inline void perf_end(const char *region) {
+    perf_thread *t = perf_self;
+    perf_sample now;
+    int i;
+
+    if (t == NULL || t->depth == 0)
+        return;
+    now = t->stack[--t->depth];
+    perf_read(t, &now);
+
+    // the regions are string literals, looked up by address
+    for (i = 0; i < t->regions_num && t->regions[i].region != region; i++)
+        ;
+    if (i == t->regions_num) {
+        if (i == PERF_REGIONS)
+            return;
+        t->regions[t->regions_num++] = (perf_row){t->role, region, 0, 0, 0, {0}};
+    }
+    perf_add(&t->regions[i], &t->stack[t->depth], &now);
+}
+
+static void perf_print_count(const perf_row *r, perf_event e) {
+    if (perf_opened[e])
+        fprintf(stderr, " %14.0f", r->counts[e]);
+    else
+        fprintf(stderr, " %14s", "-");
+}
+
+static void perf_report(void) {
+    pthread_mutex_lock(&perf_mutex);
+
+    fprintf(stderr, "\n%-16s %-24s %9s %10s %10s %14s %14s %6s %14s %14s %10s\n", "role", "region", "calls",
+            "wall ms", "cpu ms", "cycles", "instructions", "IPC", "cache-misses", "branch-misses", "ctx-sw");
+    for (int i = 0; i < perf_rows_num; i++) {
+        perf_row *r = &perf_rows[i];
+        fprintf(stderr, "%-16s %-24s %9ld %10.3f %10.3f", r->role, r->region, r->calls, r->ns / 1e6,
+                r->cpu_ns / 1e6);
+        perf_print_count(r, PERF_CYCLES);
+        perf_print_count(r, PERF_INSTRUCTIONS);
+        if (perf_opened[PERF_CYCLES] && perf_opened[PERF_INSTRUCTIONS] && r->counts[PERF_CYCLES] > 0)
+            fprintf(stderr, " %6.2f", r->counts[PERF_INSTRUCTIONS] / r->counts[PERF_CYCLES]);
+        else
+            fprintf(stderr, " %6s", "-");
+        perf_print_count(r, PERF_CACHE_MISSES);
+        perf_print_count(r, PERF_BRANCH_MISSES);
+        if (perf_opened[PERF_CONTEXT_SWITCHES])
+            fprintf(stderr, " %10.0f\n", r->counts[PERF_CONTEXT_SWITCHES]);
+        else
+            fprintf(stderr, " %10s\n", "-");
+    }
+
+    pthread_mutex_unlock(&perf_mutex);
+}
+
+#define PERF_THREAD(role) perf_thread_start(role)
+#define PERF_BEGIN(region) perf_begin(region)
+#define PERF_END(region) perf_end(region)
+#define PERF_REPORT() perf_report()
+
+#else
+
+#define PERF_THREAD(role) ((void)0)
+#define PERF_BEGIN(region) ((void)0)
+#define PERF_END(region) ((void)0)
+#define PERF_REPORT() ((void)0)
+
+#endif
+
+#endif
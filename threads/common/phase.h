@@ -0,0 +1,97 @@
+/**
+ * Phase word: a single atomic 32-bit counter that the threads advance through the states of
+ * their protocol, and on which they wait for the state they need.
+ * A waiter spins for a while (only with more than one CPU) and then sleeps with a futex on
+ * the value it has seen; who advances the word wakes the sleepers only when there are any, so
+ * a handshake between running threads costs no system call.
+ * Every waiter passes the bits of its role and every change of the value passes the bits of
+ * the roles that can go on with it (PHASE_ALL for everyone), so the kernel wakes only them.
+ * The counter only grows (wrapping around), the callers give a meaning to its values.
+*/
+
+#ifndef PHASE_H
+#define PHASE_H
+
+#include <stdint.h>
+#include <limits.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#ifndef PHASE_SPIN
+#define PHASE_SPIN 2000
+#endif
+
+#define PHASE_ALL FUTEX_BITSET_MATCH_ANY
+
+typedef struct {
+    _Atomic uint32_t value;
+    _Atomic int waiters;
+    int spin;
+} phase;
+
+static inline void phase_init(phase *p, uint32_t value) {
+    atomic_init(&p->value, value);
+    atomic_init(&p->waiters, 0);
+    // spinning on a single CPU only delays the thread that would change the value
+    p->spin = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? PHASE_SPIN : 0;
+}
+
+static inline uint32_t phase_load(phase *p) {
+    return atomic_load_explicit(&p->value, memory_order_acquire);
+}
+
+static inline void phase_wake(phase *p, uint32_t bits) {
+    // pairs with the increment of waiters in phase_wait: either the waiter sees the new value
+    // in the futex call, or this load sees the waiter
+    if (atomic_load_explicit(&p->waiters, memory_order_seq_cst) > 0)
+        syscall(SYS_futex, &p->value, FUTEX_WAKE_BITSET_PRIVATE, INT_MAX, NULL, NULL, bits);
+}
+
+static inline void phase_set(phase *p, uint32_t value, uint32_t bits) {
+    atomic_store_explicit(&p->value, value, memory_order_seq_cst);
+    phase_wake(p, bits);
+}
+
+// returns the new value
+static inline uint32_t phase_add(phase *p, uint32_t n, uint32_t bits) {
+    uint32_t value = atomic_fetch_add_explicit(&p->value, n, memory_order_seq_cst) + n;
+    phase_wake(p, bits);
+    return value;
+}
+
+// waits for the value to differ from seen and returns it
+static inline uint32_t phase_wait(phase *p, uint32_t seen, uint32_t bits) {
+    uint32_t value;
+
+    for (int i = 0; i < p->spin; i++) {
+        if ((value = atomic_load_explicit(&p->value, memory_order_acquire)) != seen)
+            return value;
+#ifdef __SSE2__
+        _mm_pause();
+#endif
+    }
+
+    while ((value = atomic_load_explicit(&p->value, memory_order_acquire)) == seen) {
+        atomic_fetch_add_explicit(&p->waiters, 1, memory_order_seq_cst);
+        // the kernel sleeps only if the value is still seen
+        syscall(SYS_futex, &p->value, FUTEX_WAIT_BITSET_PRIVATE, seen, NULL, NULL, bits);
+        atomic_fetch_sub_explicit(&p->waiters, 1, memory_order_relaxed);
+    }
+    return value;
+}
+
+// waits for the value to reach target, comparing across the wrap-around
+static inline uint32_t phase_wait_for(phase *p, uint32_t target, uint32_t bits) {
+    uint32_t value = phase_load(p);
+
+    while ((int32_t)(value - target) < 0)
+        value = phase_wait(p, value, bits);
+    return value;
+}
+
+#endif
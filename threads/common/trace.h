@@ -0,0 +1,247 @@
+/**
+ * Trace of the thread states: built with -DTRACE_EVENTS, TRACE_BEGIN(cat, name) and
+ * TRACE_END(cat, name) record the begin and the end of a span of a thread, with a category
+ * among TRACE_WAIT (on a cond var, a semaphore or a mutex), TRACE_LOCK (inside a critical
+ * section), TRACE_WORK and TRACE_IO, and TRACE_THREAD(fmt, ...) names the calling thread.
+ * The spans of a thread must be nested; cat and name must live until the exit, like literals.
+ * Every thread writes its events in its own buffer, registered once in a lock-free list, so
+ * recording an event is a clock read and a store. At exit the events of all the threads are
+ * written in the Chrome trace event format (JSON) to the file in the TRACE_FILE environment
+ * variable, trace.json by default, to be opened with Perfetto (ui.perfetto.dev) or
+ * chrome://tracing. A full buffer drops the new spans, their number is printed at exit.
+ * Without TRACE_EVENTS the macros do nothing.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#define TRACE_WAIT "wait"
+#define TRACE_LOCK "lock"
+#define TRACE_WORK "work"
+#define TRACE_IO "io"
+
+#ifdef TRACE_EVENTS
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#ifndef TRACE_BUFFER_EVENTS
+#define TRACE_BUFFER_EVENTS (1 << 16)  // events per thread
+#endif
+
+typedef struct {
+    uint64_t ns;
+    const char *cat;
+    const char *name;
+    char phase;  // 'B' or 'E'
+} trace_event;
+
+typedef struct trace_buffer {
+    struct trace_buffer *next;
+    int tid;
+    char name[32];
+    int depth;  // recorded spans still open
+    int skipped;  // dropped spans still open
+    long dropped;
+    _Atomic int events_num;
+    trace_event events[TRACE_BUFFER_EVENTS];
+} trace_buffer;
+
+static _Atomic(trace_buffer *) trace_buffers;
+static _Atomic int trace_threads;
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static __thread trace_buffer *trace_self;
+
+static inline uint64_t trace_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// the JSON is formatted by hand, printf costs more than the recording; at most 128 characters
+// of s are written, so an event always fits a line
+static inline char *trace_put(char *p, const char *s) {
+    size_t n = strlen(s);
+
+    if (n > 128)
+        n = 128;
+    memcpy(p, s, n);
+    return p + n;
+}
+
+static inline char *trace_put_number(char *p, uint64_t v, int digits) {
+    char tmp[20];
+    int n = 0;
+
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v > 0 || n < digits);
+    while (n > 0)
+        *p++ = tmp[--n];
+    return p;
+}
+
+// the names are written as they are, they must not need escaping in JSON
+static void trace_write(void) {
+    const char *path = getenv("TRACE_FILE") != NULL ? getenv("TRACE_FILE") : "trace.json";
+    trace_buffer *b;
+    uint64_t start = UINT64_MAX;
+    long events = 0, dropped = 0;
+    int pid = getpid();
+    const char *sep = "";
+    char line[512], ids[128], *p;
+    uint64_t us;
+    FILE *f;
+    int n;
+
+    if ((f = fopen(path, "w")) == NULL) {
+        fprintf(stderr, "Error in fopen: %s\n", path);
+        return;
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+
+    // the times start from the first event
+    for (b = atomic_load(&trace_buffers); b != NULL; b = b->next) {
+        if (atomic_load(&b->events_num) > 0 && b->events[0].ns < start)
+            start = b->events[0].ns;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+    for (b = atomic_load(&trace_buffers); b != NULL; b = b->next) {
+        n = atomic_load_explicit(&b->events_num, memory_order_acquire);
+        fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                sep, pid, b->tid, b->name);
+        sep = ",";
+        snprintf(ids, sizeof(ids), ",\"pid\":%d,\"tid\":%d}", pid, b->tid);
+        for (int i = 0; i < n; i++) {
+            trace_event *e = &b->events[i];
+            p = trace_put(line, ",\n{\"name\":\"");
+            p = trace_put(p, e->name);
+            p = trace_put(p, "\",\"cat\":\"");
+            p = trace_put(p, e->cat);
+            p = trace_put(p, "\",\"ph\":\"");
+            *p++ = e->phase;
+            // the time is in microseconds, with the nanoseconds as decimals
+            us = e->ns - start;
+            p = trace_put(p, "\",\"ts\":");
+            p = trace_put_number(p, us / 1000, 1);
+            *p++ = '.';
+            p = trace_put_number(p, us % 1000, 3);
+            p = trace_put(p, ids);
+            fwrite(line, 1, p - line, f);
+        }
+        events += n;
+        dropped += b->dropped;
+    }
+    fprintf(f, "\n]}\n");
+
+    if (fclose(f) != 0)
+        fprintf(stderr, "Error in fclose: %s\n", path);
+    fprintf(stderr, "trace: %ld events written to %s", events, path);
+    if (dropped > 0)
+        fprintf(stderr, ", %ld spans dropped (TRACE_BUFFER_EVENTS)", dropped);
+    fprintf(stderr, "\n");
+}
+
+static void trace_init(void) {
+    atexit(trace_write);
+}
+
+// the buffer of the calling thread, created at its first event
+static trace_buffer *trace_buffer_get(void) {
+    trace_buffer *b = trace_self;
+
+    if (b != NULL)
+        return b;
+    pthread_once(&trace_once, trace_init);
+    if ((b = malloc(sizeof(trace_buffer))) == NULL)
+        return NULL;
+
+    b->tid = atomic_fetch_add(&trace_threads, 1) + 1;
+    if (syscall(SYS_gettid) == getpid())
+        snprintf(b->name, sizeof(b->name), "main");
+    else
+        snprintf(b->name, sizeof(b->name), "thread %d", b->tid);
+    b->depth = b->skipped = 0;
+    b->dropped = 0;
+    atomic_init(&b->events_num, 0);
+
+    // the buffers are only added, never removed, until the exit
+    b->next = atomic_load(&trace_buffers);
+    while (!atomic_compare_exchange_weak(&trace_buffers, &b->next, b))
+        ;
+    return trace_self = b;
+}
+
+static inline void trace_thread(const char *fmt, ...) {
+    trace_buffer *b = trace_buffer_get();
+    va_list ap;
+
+    if (b == NULL)
+        return;
+    va_start(ap, fmt);
+    vsnprintf(b->name, sizeof(b->name), fmt, ap);
+    va_end(ap);
+}
+
+static inline void trace_record(trace_buffer *b, const char *cat, const char *name, char phase) {
+    int n = atomic_load_explicit(&b->events_num, memory_order_relaxed);
+
+    b->events[n] = (trace_event){trace_now(), cat, name, phase};
+    atomic_store_explicit(&b->events_num, n + 1, memory_order_release);
+}
+
+static inline void trace_begin(const char *cat, const char *name) {
+    trace_buffer *b = trace_buffer_get();
+
+    if (b == NULL)
+        return;
+    // a span is recorded only if there is room to end it and all the open ones
+    if (b->skipped > 0 || atomic_load_explicit(&b->events_num, memory_order_relaxed) + b->depth + 2 >
+                          TRACE_BUFFER_EVENTS) {
+        b->skipped++;
+        b->dropped++;
+        return;
+    }
+    b->depth++;
+    trace_record(b, cat, name, 'B');
+}
+
+static inline void trace_end(const char *cat, const char *name) {
+    trace_buffer *b = trace_self;
+
+    if (b == NULL)
+        return;
+    if (b->skipped > 0) {
+        b->skipped--;
+        return;
+    }
+    if (b->depth == 0)
+        return;
+    b->depth--;
+    trace_record(b, cat, name, 'E');
+}
+
+#define TRACE_THREAD(...) trace_thread(__VA_ARGS__)
+#define TRACE_BEGIN(cat, name) trace_begin((cat), (name))
+#define TRACE_END(cat, name) trace_end((cat), (name))
+
+#else
+
+#define TRACE_THREAD(...) ((void)0)
+#define TRACE_BEGIN(cat, name) ((void)0)
+#define TRACE_END(cat, name) ((void)0)
+
+#endif
+
+#endif
@@ -6,31 +6,60 @@
  * After the consumer has withdrawn an element, a neutral value must be placed in that position.
  * The program ends when all the elements have been produced and consumed, at the end the buffer
  * is empty.
+ * The buffer is a bounded_queue (../common/bounded_queue.h); the condition variables are its sync policy,
+ * another one can be chosen with -DQUEUE_SYNC=QUEUE_SYNC_... and -DQUEUE_WAIT=QUEUE_WAIT_....
 */
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
-#include <stdbool.h>
+#include <stdatomic.h>
 #include <pthread.h>
 #include <time.h>
 
+#include "../common/perfcount.h"
+#include "../common/trace.h"
+
 #define BUFFER_SIZE 10
 #define NEUTRAL_VALUE 0
 #define items_to_produce 100
 #define items_to_consume 100
 
+// prints the current buffer state
+void printBuffer(int *buffer) {
+    for (int i = 0; i < BUFFER_SIZE; i++)
+        printf("%d ", buffer[i]);
+    printf("\n\n");
+}
+
+// called by the queue while the thread owns the buffer, ctx is the index of the thread; with
+// QUEUE_SYNC_LOCKFREE the thread owns only the slot, the others are written meanwhile, so the
+// buffer is not printed
+#define QUEUE_ON_PUSH(q, i, ctx) do { \
+    printf("P%d: buffer[%zu] = %d\n", *(int *)(ctx), (i), (q)->items[i]); \
+    if (QUEUE_SYNC != QUEUE_SYNC_LOCKFREE) \
+        printBuffer((q)->items); \
+} while (0)
+
+#define QUEUE_ON_POP(q, i, ctx) do { \
+    printf("C%d: buffer[%zu] = %d\n", *(int *)(ctx), (i), (q)->items[i]); \
+    (q)->items[i] = NEUTRAL_VALUE; \
+    if (QUEUE_SYNC != QUEUE_SYNC_LOCKFREE) \
+        printBuffer((q)->items); \
+} while (0)
+
+#define QUEUE_NAME int_queue
+#define QUEUE_TYPE int
+#define QUEUE_CAPACITY BUFFER_SIZE
+#ifndef QUEUE_SYNC
+#define QUEUE_SYNC QUEUE_SYNC_COND
+#endif
+#include "../common/bounded_queue.h"
+
 typedef struct {
-    int buffer[BUFFER_SIZE];
-    int in;
-    int out;
-    int produced_items;
-    int consumed_items;
-
-    pthread_mutex_t mutex;
-    pthread_cond_t empty;
-    pthread_cond_t full;
-    int current_items_num;
+    int_queue queue;
+    _Atomic int produced_items;
+    _Atomic int consumed_items;
 } shared_data;
 
 typedef struct {
@@ -48,112 +77,49 @@ typedef struct {
 } consumer_data;
 
 void init_shared(shared_data *shared) {
+    int_queue_init(&shared->queue);
     for (int i = 0; i < BUFFER_SIZE; i++)
-        shared->buffer[i] = NEUTRAL_VALUE;
-
-    shared->in = shared->out = 0;
-
-    shared->produced_items = shared->consumed_items = 0;
+        shared->queue.items[i] = NEUTRAL_VALUE;
 
-    shared->current_items_num = 0;
-
-    int err;
-    if ((err = pthread_mutex_init(&shared->mutex, NULL)) != 0) {
-        fprintf(stderr, "Error in pthread_mutex_init: %d\n", err);
-        return;
-    }
-    if ((err = pthread_cond_init(&shared->empty, NULL)) != 0) {
-        fprintf(stderr, "Error in pthread_cond_init: %d\n", err);
-        return;        
-    }
-    if ((err = pthread_cond_init(&shared->full, NULL)) != 0) {
-        fprintf(stderr, "Error in pthread_cond_init: %d\n", err);
-        return;           
-    }
+    atomic_init(&shared->produced_items, 0);
+    atomic_init(&shared->consumed_items, 0);
 }
 
 void destroy_shared(shared_data *shared) {
-    pthread_mutex_destroy(&shared->mutex);
-    pthread_cond_destroy(&shared->empty);
-    pthread_cond_destroy(&shared->full);
+    int_queue_destroy(&shared->queue);
     free(shared);
 }
 
-// prints the current buffer state
-void printBuffer(int *buffer) {
-    for (int i = 0; i < BUFFER_SIZE; i++)
-        printf("%d ", buffer[i]);
-    printf("\n\n");
-}
-
 void producer(void *arg) {
     producer_data *prod_data = (producer_data *)arg;
     int data;
-    int err;
-
-    while (prod_data->shared->produced_items < items_to_produce) {
-        data = rand() % 99 + 1;
-
-        if ((err = pthread_mutex_lock(&prod_data->shared->mutex)) != 0)
-            fprintf(stderr, "Error in pthread_mutex_lock: %d\n", err);
 
-        while (prod_data->shared->current_items_num == BUFFER_SIZE) {
-            if ((err = pthread_cond_wait(&prod_data->shared->full, &prod_data->shared->mutex)) != 0)
-                fprintf(stderr, "Error in pthread_cond_wait: %d\n", err);
-        }
-
-        if (prod_data->shared->produced_items < items_to_produce) {  // needed for the last few threads lagged behind
-            prod_data->shared->buffer[prod_data->shared->in] = data;
-            printf("P%d: buffer[%d] = %d\n", prod_data->thread_i, prod_data->shared->in, data);
-
-            prod_data->shared->in = (prod_data->shared->in + 1) % BUFFER_SIZE;
-            prod_data->shared->produced_items++;
-
-            prod_data->shared->current_items_num++;
-
-            printBuffer(prod_data->shared->buffer);
-        }
-        
-        if ((err = pthread_cond_signal(&prod_data->shared->empty)) != 0)
-            fprintf(stderr, "Error in pthread_cond_signal: %d\n", err);
+    PERF_THREAD("producer");
+    TRACE_THREAD("P%d", prod_data->thread_i);
 
-        if ((err = pthread_mutex_unlock(&prod_data->shared->mutex)) != 0)
-            fprintf(stderr, "Error in pthread_mutex_unlock: %d\n", err);
+    // every producer takes the number of an item before producing it, so no one produces too many
+    while (atomic_fetch_add(&prod_data->shared->produced_items, 1) < items_to_produce) {
+        TRACE_BEGIN(TRACE_WORK, "produce");
+        data = rand() % 99 + 1;
+        TRACE_END(TRACE_WORK, "produce");
+        PERF_BEGIN("push");
+        int_queue_push(&prod_data->shared->queue, &data, &prod_data->thread_i);
+        PERF_END("push");
     }
 }
 
 void consumer(void *arg) {
     consumer_data *cons_data = (consumer_data *)arg;
     int data;
-    int err;
-
-    while (cons_data->shared->consumed_items < items_to_consume) {
-        if ((err = pthread_mutex_lock(&cons_data->shared->mutex)) != 0)
-            fprintf(stderr, "Error in pthread_mutex_lock: %d\n", err);
-
-        while (cons_data->shared->current_items_num == 0 && cons_data->shared->consumed_items != items_to_consume) {
-            if ((err = pthread_cond_wait(&cons_data->shared->empty, &cons_data->shared->mutex)) != 0)
-                fprintf(stderr, "Error in pthread_cond_wait: %d\n", err);            
-        }
-
-        if (cons_data->shared->consumed_items < items_to_consume) { // needed for the last few threads lagged behind
-            data = cons_data->shared->buffer[cons_data->shared->out];
-            printf("C%d: buffer[%d] = %d\n", cons_data->thread_i, cons_data->shared->out, data);
-
-            cons_data->shared->buffer[cons_data->shared->out] = NEUTRAL_VALUE;
-            cons_data->shared->out = (cons_data->shared->out + 1) % BUFFER_SIZE;
-            cons_data->shared->consumed_items++;
-
-            cons_data->shared->current_items_num--;
-
-            printBuffer(cons_data->shared->buffer);
-        }
 
-        if ((err = pthread_cond_signal(&cons_data->shared->full)) != 0)
-            fprintf(stderr, "Error in pthread_cond_signal: %d\n", err);
+    PERF_THREAD("consumer");
+    TRACE_THREAD("C%d", cons_data->thread_i);
 
-        if ((err = pthread_mutex_unlock(&cons_data->shared->mutex)) != 0)
-            fprintf(stderr, "Error in pthread_mutex_unlock: %d\n", err);
+    // every item taken has been or will be produced, the last consumers do not wait forever
+    while (atomic_fetch_add(&cons_data->shared->consumed_items, 1) < items_to_consume) {
+        PERF_BEGIN("pop");
+        int_queue_pop(&cons_data->shared->queue, &data, &cons_data->thread_i);
+        PERF_END("pop");
     }
 }
 
@@ -218,6 +184,7 @@ int main(int argc, char **argv) {
         }
     }
 
+    PERF_REPORT();
     destroy_shared(shared);
 
     exit(0);
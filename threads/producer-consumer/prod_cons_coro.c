@@ -0,0 +1,232 @@
+/**
+ * The bounded-buffer problem of prod_cons_cond_t.c with n producers and m consumers that are
+ * coroutines (../common/coro.h) instead of threads: a producer or a consumer is a struct of a
+ * few bytes, so there can be hundreds of thousands of them, run by a few worker threads, by
+ * default one per CPU.
+ * The buffer is a circular array of size 10 with the waiting producers and consumers in two
+ * lists; a producer that finds the buffer full, or a consumer that finds it empty, parks in
+ * its list and returns to its worker, and whoever frees a slot or fills one completes its
+ * operation for it and makes it runnable again, so no one waits in the kernel.
+ * As in prod_cons_cond_t.c the number of elements to be produced and consumed is 100
+ * (-Ditems_to_produce=... for more), after the consumer has withdrawn an element a neutral
+ * value is placed in that position and at the end the buffer is empty. The workers, resumes,
+ * suspensions and steals are printed on the standard error at the end.
+ * Usage: prod_cons_coro <number of producers> <number of consumers> [number of workers]
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../common/coro.h"
+
+#define BUFFER_SIZE 10
+#define NEUTRAL_VALUE 0
+#ifndef items_to_produce
+#define items_to_produce 100
+#endif
+#define items_to_consume items_to_produce
+
+typedef struct {
+    coro_task task;
+    int thread_i;
+    int data;  // the item being pushed or popped, it must survive a suspension
+
+    struct shared_data *shared;
+} producer_data, consumer_data;
+
+typedef struct shared_data {
+    int buffer[BUFFER_SIZE];
+    size_t head, tail, count;
+    pthread_mutex_t mutex;
+    coro_list not_full;  // the producers waiting for a slot
+    coro_list not_empty;  // the consumers waiting for an item
+
+    coro_sched sched;
+    _Atomic int produced_items;
+    _Atomic int consumed_items;
+} shared_data;
+
+// prints the current buffer state
+void printBuffer(int *buffer) {
+    for (int i = 0; i < BUFFER_SIZE; i++)
+        printf("%d ", buffer[i]);
+    printf("\n\n");
+}
+
+// the buffer operations, with the mutex held and the buffer not full or not empty
+void put(shared_data *shared, producer_data *prod) {
+    size_t i = shared->tail;
+
+    shared->buffer[i] = prod->data;
+    shared->tail = (i + 1) % BUFFER_SIZE;
+    shared->count++;
+    printf("P%d: buffer[%zu] = %d\n", prod->thread_i, i, shared->buffer[i]);
+    printBuffer(shared->buffer);
+}
+
+void take(shared_data *shared, consumer_data *cons) {
+    size_t i = shared->head;
+
+    cons->data = shared->buffer[i];
+    printf("C%d: buffer[%zu] = %d\n", cons->thread_i, i, shared->buffer[i]);
+    shared->buffer[i] = NEUTRAL_VALUE;
+    printBuffer(shared->buffer);
+    shared->head = (i + 1) % BUFFER_SIZE;
+    shared->count--;
+}
+
+// true if the item is in the buffer, false if the producer has been parked until a consumer
+// puts it there
+bool push(shared_data *shared, producer_data *prod) {
+    consumer_data *cons = NULL;
+
+    pthread_mutex_lock(&shared->mutex);
+    if (shared->count == BUFFER_SIZE) {
+        coro_list_push(&shared->not_full, &prod->task);
+        pthread_mutex_unlock(&shared->mutex);
+        return false;
+    }
+    put(shared, prod);
+    // a waiting consumer means the buffer was empty, the item is taken for it
+    if ((cons = (consumer_data *)coro_list_pop(&shared->not_empty)) != NULL)
+        take(shared, cons);
+    pthread_mutex_unlock(&shared->mutex);
+
+    if (cons != NULL)
+        coro_wake(&shared->sched, &cons->task);
+    return true;
+}
+
+// true if an item has been taken, false if the consumer has been parked until a producer
+// takes one for it
+bool pop(shared_data *shared, consumer_data *cons) {
+    producer_data *prod = NULL;
+
+    pthread_mutex_lock(&shared->mutex);
+    if (shared->count == 0) {
+        coro_list_push(&shared->not_empty, &cons->task);
+        pthread_mutex_unlock(&shared->mutex);
+        return false;
+    }
+    take(shared, cons);
+    // a waiting producer means the buffer was full, its item goes in the free slot
+    if ((prod = (producer_data *)coro_list_pop(&shared->not_full)) != NULL)
+        put(shared, prod);
+    pthread_mutex_unlock(&shared->mutex);
+
+    if (prod != NULL)
+        coro_wake(&shared->sched, &prod->task);
+    return true;
+}
+
+void init_shared(shared_data *shared, int workers_num) {
+    for (int i = 0; i < BUFFER_SIZE; i++)
+        shared->buffer[i] = NEUTRAL_VALUE;
+    shared->head = shared->tail = shared->count = 0;
+    pthread_mutex_init(&shared->mutex, NULL);
+    shared->not_full = shared->not_empty = (coro_list){NULL, NULL};
+
+    coro_sched_init(&shared->sched, workers_num);
+    atomic_init(&shared->produced_items, 0);
+    atomic_init(&shared->consumed_items, 0);
+}
+
+void destroy_shared(shared_data *shared) {
+    coro_sched_destroy(&shared->sched);
+    pthread_mutex_destroy(&shared->mutex);
+    free(shared);
+}
+
+coro_status producer(coro_task *t) {
+    producer_data *prod_data = (producer_data *)t;
+    shared_data *shared = prod_data->shared;
+
+    CORO_BEGIN(t);
+    // every producer takes the number of an item before producing it, so no one produces too many
+    while (atomic_fetch_add(&shared->produced_items, 1) < items_to_produce) {
+        prod_data->data = rand() % 99 + 1;
+        CORO_AWAIT(t, push(shared, prod_data));
+    }
+    CORO_END(t);
+}
+
+coro_status consumer(coro_task *t) {
+    consumer_data *cons_data = (consumer_data *)t;
+    shared_data *shared = cons_data->shared;
+
+    CORO_BEGIN(t);
+    // every item taken has been or will be produced, the last consumers do not wait forever
+    while (atomic_fetch_add(&shared->consumed_items, 1) < items_to_consume)
+        CORO_AWAIT(t, pop(shared, cons_data));
+    CORO_END(t);
+}
+
+int main(int argc, char **argv) {
+    // check parameters number
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "Usage: %s <number of producers> <number of consumers> [number of workers]\n", argv[0]);
+        exit(1);
+    }
+
+    char *str_end1, *str_end2, *str_end3 = "";
+    int producers_num = (int)strtol(argv[1], &str_end1, 10);
+    int consumers_num = (int)strtol(argv[2], &str_end2, 10);
+    int workers_num = argc == 4 ? (int)strtol(argv[3], &str_end3, 10) : (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    // check parameters
+    if ((*str_end1 != '\0' || producers_num <= 0) || (*str_end2 != '\0' || consumers_num <= 0)) {
+        fprintf(stderr, "Invalid number of producers and consumers.\n");
+        exit(1);
+    }
+    if (*str_end3 != '\0' || workers_num <= 0) {
+        fprintf(stderr, "Invalid number of workers.\n");
+        exit(1);
+    }
+
+    shared_data *shared = malloc(sizeof(shared_data));
+    // too many for the stack
+    producer_data *prod_data = malloc(producers_num * sizeof(producer_data));
+    consumer_data *cons_data = malloc(consumers_num * sizeof(consumer_data));
+    long resumes = 0, suspensions = 0, steals = 0;
+    struct timespec start, end;
+
+    init_shared(shared, workers_num);
+
+    // spawn producers and consumers, dealt among the workers
+    srand(time(NULL));
+    for (int i = 0; i < producers_num; i++) {
+        prod_data[i].thread_i = i + 1;
+        prod_data[i].shared = shared;
+        coro_spawn(&shared->sched, &prod_data[i].task, producer);
+    }
+    for (int i = 0; i < consumers_num; i++) {
+        cons_data[i].thread_i = i + 1;
+        cons_data[i].shared = shared;
+        coro_spawn(&shared->sched, &cons_data[i].task, consumer);
+    }
+
+    // waiting for all of them to terminate
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    coro_sched_run(&shared->sched);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    for (int i = 0; i < workers_num; i++) {
+        resumes += shared->sched.workers[i].resumes;
+        suspensions += shared->sched.workers[i].suspensions;
+        steals += shared->sched.workers[i].steals;
+    }
+    fprintf(stderr, "%d producers and %d consumers on %d workers: %.3f ms, %ld resumes, %ld suspensions, %ld steals\n",
+            producers_num, consumers_num, workers_num,
+            (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6, resumes, suspensions, steals);
+
+    destroy_shared(shared);
+    free(prod_data);
+    free(cons_data);
+
+    exit(0);
+}
@@ -0,0 +1,248 @@
+/**
+ * The bounded-buffer problem of prod_cons_cond_t.c with the consumers in an event loop: every
+ * consumer waits in epoll_wait, as a reactor would, instead of in pthread_cond_wait, on the
+ * eventfd of the queue (QUEUE_EVENTFD in ../common/bounded_queue.h) and on a second eventfd
+ * that says the work is over. When the queue becomes readable the consumer drains it with
+ * try_pop, a batch of items per wake-up; only the push that finds the queue empty writes the
+ * eventfd, so a queue that the consumers do not empty costs no system call.
+ * The producers, the buffer of size 10 and the 100 elements to be produced and consumed are
+ * the ones of prod_cons_cond_t.c; the consumer that takes the last element ends the loops of all
+ * of them. The items and the batches of every consumer are printed at the end.
+ * The sync policy can be chosen with -DQUEUE_SYNC=QUEUE_SYNC_... as in prod_cons_cond_t.c.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define BUFFER_SIZE 10
+#define NEUTRAL_VALUE 0
+#define items_to_produce 100
+#define items_to_consume 100
+
+// prints the current buffer state
+void printBuffer(int *buffer) {
+    for (int i = 0; i < BUFFER_SIZE; i++)
+        printf("%d ", buffer[i]);
+    printf("\n\n");
+}
+
+// called by the queue while the thread owns the buffer, ctx is the index of the thread; with
+// QUEUE_SYNC_LOCKFREE the thread owns only the slot, the others are written meanwhile, so the
+// buffer is not printed
+#define QUEUE_ON_PUSH(q, i, ctx) do { \
+    printf("P%d: buffer[%zu] = %d\n", *(int *)(ctx), (i), (q)->items[i]); \
+    if (QUEUE_SYNC != QUEUE_SYNC_LOCKFREE) \
+        printBuffer((q)->items); \
+} while (0)
+
+#define QUEUE_ON_POP(q, i, ctx) do { \
+    printf("C%d: buffer[%zu] = %d\n", *(int *)(ctx), (i), (q)->items[i]); \
+    (q)->items[i] = NEUTRAL_VALUE; \
+    if (QUEUE_SYNC != QUEUE_SYNC_LOCKFREE) \
+        printBuffer((q)->items); \
+} while (0)
+
+#define QUEUE_NAME int_queue
+#define QUEUE_TYPE int
+#define QUEUE_CAPACITY BUFFER_SIZE
+#ifndef QUEUE_SYNC
+#define QUEUE_SYNC QUEUE_SYNC_COND
+#endif
+#ifndef QUEUE_EVENTFD
+#define QUEUE_EVENTFD
+#endif
+#include "../common/bounded_queue.h"
+
+typedef struct {
+    int_queue queue;
+    int done;  // eventfd, readable when all the items have been consumed
+    _Atomic int produced_items;
+    _Atomic int consumed_items;
+} shared_data;
+
+typedef struct {
+    pthread_t tid;
+    int thread_i;
+
+    shared_data *shared;
+} producer_data;
+
+typedef struct {
+    pthread_t tid;
+    int thread_i;
+    int items;
+    int batches;
+
+    shared_data *shared;
+} consumer_data;
+
+void init_shared(shared_data *shared) {
+    int_queue_init(&shared->queue);
+    for (int i = 0; i < BUFFER_SIZE; i++)
+        shared->queue.items[i] = NEUTRAL_VALUE;
+
+    if ((shared->done = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1) {
+        fprintf(stderr, "Error in eventfd: %d\n", errno);
+        exit(1);
+    }
+    atomic_init(&shared->produced_items, 0);
+    atomic_init(&shared->consumed_items, 0);
+}
+
+void destroy_shared(shared_data *shared) {
+    int_queue_destroy(&shared->queue);
+    close(shared->done);
+    free(shared);
+}
+
+void producer(void *arg) {
+    producer_data *prod_data = (producer_data *)arg;
+    int data;
+
+    // every producer takes the number of an item before producing it, so no one produces too many
+    while (atomic_fetch_add(&prod_data->shared->produced_items, 1) < items_to_produce) {
+        data = rand() % 99 + 1;
+        int_queue_push(&prod_data->shared->queue, &data, &prod_data->thread_i);
+    }
+}
+
+// takes the items in the queue, true when the last one has been consumed
+bool drain(consumer_data *cons_data) {
+    shared_data *shared = cons_data->shared;
+    int data, n = 0;
+    bool last = false;
+
+    // cleared before the pops, so a push that finds the queue empty in the meantime is not lost
+    int_queue_ready_clear(&shared->queue);
+    while (int_queue_try_pop(&shared->queue, &data, &cons_data->thread_i)) {
+        n++;
+        if (atomic_fetch_add(&shared->consumed_items, 1) + 1 == items_to_consume)
+            last = true;
+    }
+
+    cons_data->items += n;
+    cons_data->batches += n > 0;
+    return last;
+}
+
+void consumer(void *arg) {
+    consumer_data *cons_data = (consumer_data *)arg;
+    shared_data *shared = cons_data->shared;
+    struct epoll_event ev, events[2];
+    uint64_t one = 1;
+    int epfd, n;
+    bool done = false;
+
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+        fprintf(stderr, "Error in epoll_create1: %d\n", errno);
+        exit(1);
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = shared->queue.ready;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, shared->queue.ready, &ev) == -1) {
+        fprintf(stderr, "Error in epoll_ctl: %d\n", errno);
+        exit(1);
+    }
+    ev.data.fd = shared->done;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, shared->done, &ev) == -1) {
+        fprintf(stderr, "Error in epoll_ctl: %d\n", errno);
+        exit(1);
+    }
+
+    while (!done) {
+        if ((n = epoll_wait(epfd, events, 2, -1)) == -1) {
+            if (errno != EINTR)
+                fprintf(stderr, "Error in epoll_wait: %d\n", errno);
+            continue;
+        }
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == shared->done)
+                done = true;  // the eventfd is not read, it stays readable for the others
+            else if (drain(cons_data)) {
+                if (write(shared->done, &one, sizeof(one)) != sizeof(one))
+                    fprintf(stderr, "Error in write: %d\n", errno);
+                done = true;
+            }
+        }
+    }
+
+    close(epfd);
+}
+
+int main(int argc, char **argv) {
+    // check parameters number
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <number of producers> <number of consumers>\n", argv[0]);
+        exit(1);
+    }
+
+    char *str_end1, *str_end2;
+    int  producers_num = (int)strtol(argv[1], &str_end1, 10);
+    int consumers_num = (int)strtol(argv[2], &str_end2, 10);
+
+    // check parameters
+    if ((*str_end1 != '\0' || producers_num <= 0) || (*str_end2 != '\0' || consumers_num <= 0)) {
+        fprintf(stderr, "Invalid number of producers and consumers.\n");
+        exit(1);
+    }
+
+    shared_data *shared = malloc(sizeof(shared_data));
+    producer_data prod_data[producers_num];
+    consumer_data cons_data[consumers_num];
+    int err;
+
+    init_shared(shared);
+
+    // create producers
+    srand(time(NULL));
+    for (int i = 0; i < producers_num; i++) {
+        prod_data[i].thread_i = i + 1;
+        prod_data[i].shared = shared;
+        if ((err = pthread_create(&prod_data[i].tid, NULL, (void *)producer, &prod_data[i])) != 0) {
+            fprintf(stderr, "Error in pthread_create: %d\n", err);
+            exit(1);
+        }
+    }
+
+    // create consumers
+    for (int i = 0; i < consumers_num; i++) {
+        cons_data[i].thread_i = i + 1;
+        cons_data[i].items = cons_data[i].batches = 0;
+        cons_data[i].shared = shared;
+        if ((err = pthread_create(&cons_data[i].tid, NULL, (void *)consumer, &cons_data[i])) != 0) {
+            fprintf(stderr, "Error in pthread_create: %d\n", err);
+            exit(1);
+        }
+    }
+
+    // waiting for the producers to terminate
+    for (int i = 0; i < producers_num; i++) {
+        if ((err = pthread_join(prod_data[i].tid, NULL)) != 0) {
+            fprintf(stderr, "Error in pthread_join: %d\n", err);
+            exit(1);
+        }
+    }
+
+    // waiting for the consumers to terminate
+    for (int i = 0; i < consumers_num; i++) {
+        if ((err = pthread_join(cons_data[i].tid, NULL)) != 0) {
+            fprintf(stderr, "Error in pthread_join: %d\n", err);
+            exit(1);
+        }
+    }
+
+    for (int i = 0; i < consumers_num; i++)
+        printf("C%d: %d items in %d batches\n", cons_data[i].thread_i, cons_data[i].items, cons_data[i].batches);
+    destroy_shared(shared);
+
+    exit(0);
+}
@@ -0,0 +1,493 @@
+/**
+ *  The program takes the number of games as input and simulates a series of games between
+ *  two virtual players P1 and P2 who play chinese morra, as chinese_morra_cond_t.c does, but
+ *  in batches of rounds instead of one handshake per move, to play millions of games per
+ *  second. The threads are the same: P1, P2, the judge and the scoreboard.
+ *  The players fill their own array of moves in a batch of BATCH_ROUNDS rounds; there are
+ *  SLOTS_NUM batches used in turn, so the players fill the next batch while the judge scores
+ *  the previous one. The judge walks the rounds of a batch in order: a round with a winner
+ *  ends a game, a drawn round is played again by the next round, as when the judge raises
+ *  the same game. The rounds after the last game are discarded.
+ *  The judge adds the results of every batch to the deltas shared with the scoreboard, which
+ *  collects them and shows the final score and the final winner.
+ *  The threads are coordinated via condition vars, once per batch.
+ *  With -l the game is rock-paper-scissors-lizard-Spock. The batches are scored with the
+ *  vectorized table lookup of morra_rules.h.
+ *  With -p the program estimates the win rate of P1 (over the decided games) and the draw
+ *  rate (over the rounds) with Wilson confidence intervals, updated by the scoreboard at every
+ *  batch, and stops as soon as both intervals are within the given precision, reporting the
+ *  games saved with respect to the number of matches.
+ *  With -o the scoreboard writes every game to a binary log (match_log.h), about a byte per
+ *  game, which morra_log_reader.c aggregates: the judge leaves every scored batch to the
+ *  scoreboard, which logs its games and then gives it back to the players.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "../../common/lockprof.h"
+#include "morra_rules.h"
+#include "match_log.h"
+
+#define BATCH_ROUNDS (1 << 16)
+#define SLOTS_NUM 2
+
+// 95% confidence
+#ifndef CONFIDENCE_Z
+#define CONFIDENCE_Z 1.96
+#endif
+
+typedef enum { PLAYER1, PLAYER2, JUDGE, SCOREBOARD } threads_name;
+
+typedef struct {
+    move moves[2][BATCH_ROUNDS];
+    bool filled[2];
+
+    // scored by the judge and not yet logged by the scoreboard
+    long rounds;
+    bool judged;
+} rounds_batch;
+
+typedef struct {
+    rounds_batch batches[SLOTS_NUM];
+    const morra_rules *rules;
+    long games_num;
+    double precision;  // 0 to play all games
+    bool ended;
+    long played_games;
+    match_log *log;  // NULL if the games are not logged
+
+    // results of the judge not yet collected by the scoreboard
+    long wins[2];
+    long draws;
+    bool show_score;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond[4];
+} shared;
+
+typedef struct {
+    pthread_t tid;
+    int thread_i;
+
+    shared *sh;
+} threads_data;
+
+void init_shared(shared *sh, const morra_rules *rules, long games_num, double precision, match_log *log) {
+    sh->rules = rules;
+    sh->games_num = games_num;
+    sh->precision = precision;
+    sh->ended = false;
+    sh->played_games = 0;
+    sh->log = log;
+    sh->wins[0] = sh->wins[1] = 0;
+    sh->draws = 0;
+    sh->show_score = false;
+
+    for (int i = 0; i < SLOTS_NUM; i++) {
+        sh->batches[i].filled[PLAYER1] = sh->batches[i].filled[PLAYER2] = false;
+        sh->batches[i].judged = false;
+    }
+
+    // cond init
+    int err;
+    if ((err = pthread_mutex_init(&sh->mutex, NULL)) != 0) {
+        fprintf(stderr, "Error in pthread_mutex_init: %d\n", err);
+        return;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        if ((err = pthread_cond_init(&sh->cond[i], NULL)) != 0) {
+            fprintf(stderr, "Error in pthread_cond_init: %d\n", err);
+            return;
+        }
+    }
+
+    // roles of the lock profiler (lockprof.h)
+    LOCKPROF_NAME(&sh->mutex, "mutex");
+    LOCKPROF_NAME(&sh->cond[PLAYER1], "cond[PLAYER1]");
+    LOCKPROF_NAME(&sh->cond[PLAYER2], "cond[PLAYER2]");
+    LOCKPROF_NAME(&sh->cond[JUDGE], "cond[JUDGE]");
+    LOCKPROF_NAME(&sh->cond[SCOREBOARD], "cond[SCOREBOARD]");
+}
+
+void destroy_shared(shared *sh) {
+    pthread_mutex_destroy(&sh->mutex);
+    for (int i = 0; i < 4; i++)
+        pthread_cond_destroy(&sh->cond[i]);
+    free(sh);
+}
+
+// xorshift64*, one generator per player
+uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1Dull;
+}
+
+void player(void *arg) {
+    threads_data *td = (threads_data *)arg;
+    int p = td->thread_i - 1;
+    uint64_t state = (uint64_t)time(NULL) * 0x9E3779B97F4A7C15ull + td->thread_i;
+    uint64_t moves_num = td->sh->rules->moves_num;
+    rounds_batch *b;
+    int err;
+
+    for (long n = 0;; n++) {
+        b = &td->sh->batches[n % SLOTS_NUM];
+
+        // lock
+        if ((err = pthread_mutex_lock(&td->sh->mutex)) != 0)
+            fprintf(stderr, "Error in pthread_mutex_lock: %d\n", err);
+
+        // the players await the judge to score the batch
+        while (b->filled[p] && !td->sh->ended) {
+            if ((err = pthread_cond_wait(&td->sh->cond[p], &td->sh->mutex)) != 0)
+                fprintf(stderr, "Error in pthread_cond_wait: %d\n", err);
+        }
+
+        // all games have been played
+        if (td->sh->ended) {
+            if ((err = pthread_mutex_unlock(&td->sh->mutex)) != 0)
+                fprintf(stderr, "Error in pthread_mutex_unlock: %d\n", err);
+            break;
+        }
+
+        // unlock
+        if ((err = pthread_mutex_unlock(&td->sh->mutex)) != 0)
+            fprintf(stderr, "Error in pthread_mutex_unlock: %d\n", err);
+
+        // the judge does not read the batch until it is filled, the moves need no lock
+        for (int i = 0; i < BATCH_ROUNDS; i++)
+            b->moves[p][i] = (move)(((next_random(&state) >> 32) * moves_num) >> 32);
+
+        // lock
+        if ((err = pthread_mutex_lock(&td->sh->mutex)) != 0)
+            fprintf(stderr, "Error in pthread_mutex_lock: %d\n", err);
+
+        // the players have made their own moves
+        b->filled[p] = true;
+        if ((err = pthread_cond_signal(&td->sh->cond[JUDGE])) != 0)
+            fprintf(stderr, "Error in pthread_cond_signal: %d\n", err);
+
+        // unlock
+        if ((err = pthread_mutex_unlock(&td->sh->mutex)) != 0)
+            fprintf(stderr, "Error in pthread_mutex_unlock: %d\n", err);
+    }
+}
+
+void judge(void *arg) {
+    threads_data *td = (threads_data *)arg;
+    long ended_games = 0;
+    long wins[2], draws;
+    long rounds;
+    rounds_batch *b;
+    int winner, err;
+
+    for (long n = 0; ended_games < td->sh->games_num; n++) {
+        b = &td->sh->batches[n % SLOTS_NUM];
+
+        // lock
+        if ((err = pthread_mutex_lock(&td->sh->mutex)) != 0)
+            fprintf(stderr, "Error in pthread_mutex_lock: %d\n", err);
+
+        // wait for both players moves, on a batch the scoreboard has logged
+        while ((!b->filled[PLAYER1] || !b->filled[PLAYER2] || b->judged) && !td->sh->ended) {
+            if ((err = pthread_cond_wait(&td->sh->cond[JUDGE], &td->sh->mutex)) != 0)
+                fprintf(stderr, "Error in pthread_cond_wait: %d\n", err);
+        }
+
+        // the scoreboard has reached the precision
+        if (td->sh->ended) {
+            if ((err = pthread_mutex_unlock(&td->sh->mutex)) != 0)
+                fprintf(stderr, "Error in pthread_mutex_unlock: %d\n", err);
+            break;
+        }
+
+        // unlock
+        if ((err = pthread_mutex_unlock(&td->sh->mutex)) != 0)
+            fprintf(stderr, "Error in pthread_mutex_unlock: %d\n", err);
+
+        // a drawn round is played again by the next one
+        wins[0] = wins[1] = 0;
+        if (td->sh->games_num - ended_games >= BATCH_ROUNDS) {
+            // every round ends at most one game, the whole batch is needed
+            score_rounds(td->sh->rules, b->moves[PLAYER1], b->moves[PLAYER2], BATCH_ROUNDS, wins);
+            rounds = BATCH_ROUNDS;
+        }
+        else {
+            // the last batch stops at the last game
+            for (rounds = 0; rounds < BATCH_ROUNDS && ended_games + wins[0] + wins[1] < td->sh->games_num; rounds++) {
+                winner = morra_result(td->sh->rules, b->moves[PLAYER1][rounds], b->moves[PLAYER2][rounds]);
+                if (winner >= 0)
+                    wins[winner]++;
+            }
+        }
+        ended_games += wins[0] + wins[1];
+        draws = rounds - wins[0] - wins[1];
+
+        // lock
+        if ((err = pthread_mutex_lock(&td->sh->mutex)) != 0)
+            fprintf(stderr, "Error in pthread_mutex_lock: %d\n", err);
+
+        if (ended_games == td->sh->games_num)
+            td->sh->ended = true;
+        b->rounds = rounds;
+
+        if (td->sh->log != NULL)
+            // the scoreboard logs the games of the batch before the players fill it again
+            b->judged = true;
+        else {
+            // the players can fill the batch again
+            b->filled[PLAYER1] = b->filled[PLAYER2] = false;
+            if ((err = pthread_cond_signal(&td->sh->cond[PLAYER1])) != 0)
+                fprintf(stderr, "Error in pthread_cond_signal: %d\n", err);
+            if ((err = pthread_cond_signal(&td->sh->cond[PLAYER2])) != 0)
+                fprintf(stderr, "Error in pthread_cond_signal: %d\n", err);
+
+            // the scoreboard collects the results without stopping the judge
+            td->sh->wins[0] += wins[0];
+            td->sh->wins[1] += wins[1];
+            td->sh->draws += draws;
+            td->sh->show_score = true;
+        }
+        if ((err = pthread_cond_signal(&td->sh->cond[SCOREBOARD])) != 0)
+            fprintf(stderr, "Error in pthread_cond_signal: %d\n", err);
+
+        // unlock
+        if ((err = pthread_mutex_unlock(&td->sh->mutex)) != 0)
+            fprintf(stderr, "Error in pthread_mutex_unlock: %d\n", err);
+    }
+}
+
+// half width of the Wilson score interval of successes out of n trials
+double wilson_half_width(long successes, long n) {
+    double z2 = CONFIDENCE_Z * CONFIDENCE_Z;
+    double p = (double)successes / n;
+
+    return CONFIDENCE_Z / (1 + z2 / n) * sqrt(p * (1 - p) / n + z2 / (4.0 * n * n));
+}
+
+// logs the games of a judged batch and adds them to the score, the redraws go on across batches
+void log_batch(shared *sh, rounds_batch *b, long score[2], long *draws, long *redraws) {
+    int winner;
+
+    for (long i = 0; i < b->rounds; i++) {
+        winner = morra_result(sh->rules, b->moves[PLAYER1][i], b->moves[PLAYER2][i]);
+        if (winner < 0) {
+            (*redraws)++;
+            continue;
+        }
+        log_game(sh->log, b->moves[PLAYER1][i], b->moves[PLAYER2][i], *redraws);
+        *draws += *redraws;
+        *redraws = 0;
+        score[winner]++;
+    }
+}
+
+void scoreboard(void *arg) {
+    threads_data *td = (threads_data *)arg;
+    long score[2] = {0};
+    long draws = 0;
+    long redraws = 0;
+    long decided;
+    rounds_batch *b;
+    double win_width = 1, draw_width = 1;
+    bool converged = false;
+    int err;
+
+    for (long n = 0; score[0] + score[1] < td->sh->games_num && !converged; n++) {
+        b = &td->sh->batches[n % SLOTS_NUM];
+
+        // lock
+        if ((err = pthread_mutex_lock(&td->sh->mutex)) != 0)
+            fprintf(stderr, "Error in pthread_mutex_lock: %d\n", err);
+
+        // the scoreboard awaits the judge
+        while (td->sh->log != NULL ? !b->judged : !td->sh->show_score) {
+            if ((err = pthread_cond_wait(&td->sh->cond[SCOREBOARD], &td->sh->mutex)) != 0)
+                fprintf(stderr, "Error in pthread_cond_wait: %d\n", err);
+        }
+
+        if (td->sh->log != NULL) {
+            // unlock
+            if ((err = pthread_mutex_unlock(&td->sh->mutex)) != 0)
+                fprintf(stderr, "Error in pthread_mutex_unlock: %d\n", err);
+
+            // the players and the judge do not touch the batch until it is given back
+            log_batch(td->sh, b, score, &draws, &redraws);
+
+            // lock
+            if ((err = pthread_mutex_lock(&td->sh->mutex)) != 0)
+                fprintf(stderr, "Error in pthread_mutex_lock: %d\n", err);
+
+            // the players can fill the batch again
+            b->judged = false;
+            b->filled[PLAYER1] = b->filled[PLAYER2] = false;
+            if ((err = pthread_cond_signal(&td->sh->cond[PLAYER1])) != 0)
+                fprintf(stderr, "Error in pthread_cond_signal: %d\n", err);
+            if ((err = pthread_cond_signal(&td->sh->cond[PLAYER2])) != 0)
+                fprintf(stderr, "Error in pthread_cond_signal: %d\n", err);
+        }
+        else {
+            // collect the results of the last batches
+            score[0] += td->sh->wins[0];
+            score[1] += td->sh->wins[1];
+            draws += td->sh->draws;
+            td->sh->wins[0] = td->sh->wins[1] = 0;
+            td->sh->draws = 0;
+            td->sh->show_score = false;
+        }
+
+        // stop the players and the judge once both estimates are precise enough
+        decided = score[0] + score[1];
+        if (td->sh->precision > 0 && decided > 0) {
+            win_width = wilson_half_width(score[0], decided);
+            draw_width = wilson_half_width(draws, decided + draws);
+            if (win_width <= td->sh->precision && draw_width <= td->sh->precision && decided < td->sh->games_num) {
+                converged = true;
+                td->sh->ended = true;
+                for (int i = 0; i < 3; i++) {
+                    if ((err = pthread_cond_signal(&td->sh->cond[i])) != 0)
+                        fprintf(stderr, "Error in pthread_cond_signal: %d\n", err);
+                }
+            }
+        }
+
+        // unlock
+        if ((err = pthread_mutex_unlock(&td->sh->mutex)) != 0)
+            fprintf(stderr, "Error in pthread_mutex_unlock: %d\n", err);
+    }
+
+    decided = score[0] + score[1];
+    td->sh->played_games = decided;
+
+    printf("\nFinal score:\n");
+    printf("P1 = %ld, P2 = %ld (%ld draws)\n", score[0], score[1], draws);
+    if (td->sh->precision > 0) {
+        win_width = wilson_half_width(score[0], decided);
+        draw_width = wilson_half_width(draws, decided + draws);
+        printf("P1 win rate = %.5f +- %.5f, draw rate = %.5f +- %.5f\n", (double)score[0] / decided, win_width,
+               (double)draws / (decided + draws), draw_width);
+        printf("%ld games saved out of %ld (%.1f%%)\n", td->sh->games_num - decided, td->sh->games_num,
+               100.0 * (td->sh->games_num - decided) / td->sh->games_num);
+    }
+    if (score[0] == score[1])
+        printf("Draw game\n\n");
+    else {
+        printf("Final winner of the match is ");
+        if (score[0] > score[1])
+            printf("P1\n\n");
+        else
+            printf("P2\n\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    const morra_rules *rules = &rps_rules;
+    double precision = 0;
+    const char *log_path = NULL;
+    match_log *log = NULL;
+    char *str_end;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "lp:o:")) != -1) {
+        switch (opt) {
+        case 'l':
+            rules = &rpsls_rules;
+            break;
+        case 'p':
+            precision = strtod(optarg, &str_end);
+            if (*str_end != '\0' || !(precision > 0 && precision < 1)) {
+                fprintf(stderr, "Invalid precision\n");
+                exit(1);
+            }
+            break;
+        case 'o':
+            log_path = optarg;
+            break;
+        default:
+            optind = argc;  // print the usage
+            break;
+        }
+    }
+
+    // check parameters number
+    if (argc - optind != 1) {
+        fprintf(stderr, "Usage: %s [-l] [-p precision] [-o log-file] <number of matches>\n", argv[0]);
+        exit(1);
+    }
+
+    char *str_end1;
+    long games_num = strtol(argv[optind], &str_end1, 10);
+
+    // check parameter
+    if ((*str_end1 != '\0' || games_num <= 0)) {
+        fprintf(stderr, "Invalid input\n");
+        exit(1);
+    }
+
+    threads_data td[4];
+    shared *sh = malloc(sizeof(shared));
+    struct timespec start, end;
+    double seconds;
+    int err;
+
+    if (log_path != NULL && (log = log_open(log_path, rules->moves_num)) == NULL)
+        exit(1);
+
+    init_shared(sh, rules, games_num, precision, log);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // init and create threads
+    for (int i = 0; i < 4; i++)
+        td[i].sh = sh;
+
+    td[0].thread_i = 1;
+    if ((err = pthread_create(&td[0].tid, NULL, (void *)player, &td[0])) != 0) {
+        fprintf(stderr, "Error in pthread_create: %d\n", err);
+        exit(1);
+    }
+
+    td[1].thread_i = 2;
+    if ((err = pthread_create(&td[1].tid, NULL, (void *)player, &td[1])) != 0) {
+        fprintf(stderr, "Error in pthread_create: %d\n", err);
+        exit(1);
+    }
+
+    if ((err = pthread_create(&td[2].tid, NULL, (void *)judge, &td[2])) != 0) {
+        fprintf(stderr, "Error in pthread_create: %d\n", err);
+        exit(1);
+    }
+
+    if ((err = pthread_create(&td[3].tid, NULL, (void *)scoreboard, &td[3])) != 0) {
+        fprintf(stderr, "Error in pthread_create: %d\n", err);
+        exit(1);
+    }
+
+    // waiting for threads to terminate
+    for (int i = 0; i < 4; i++) {
+        if ((err = pthread_join(td[i].tid, NULL)) != 0) {
+            fprintf(stderr, "Error in pthread_join: %d\n", err);
+            exit(1);
+        }
+    }
+
+    if (log != NULL && !log_close(log))
+        exit(1);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%ld games in %.3f s (%.0f games/s)\n", sh->played_games, seconds, sh->played_games / seconds);
+
+    destroy_shared(sh);
+
+    exit(0);
+}
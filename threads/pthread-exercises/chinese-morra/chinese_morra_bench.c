@@ -0,0 +1,322 @@
+/**
+ *  Round-trip benchmark of the synchronization of the chinese morra programs: the judge,
+ *  the players and the scoreboard play the games with the same handshakes of
+ *  chinese_morra_cond_t.c (a mutex and a condition var per role), chinese_morra_sem_t.c
+ *  (a semaphore per role) and chinese_morra_futex_t.c (a single phase word), without
+ *  printing anything, and the time of a round (judge -> players -> judge, plus the
+ *  scoreboard when the round has a winner) is reported for each one.
+ *  The program takes the number of games as input, 1000000 by default.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "morra_rules.h"
+#include "../../common/phase.h"
+
+#define ROUND_STATES 8
+
+typedef enum { PLAYER1, PLAYER2, JUDGE, SCOREBOARD } threads_name;
+
+typedef enum { START, MOVES, JUDGING = MOVES + 2, SCORING } round_state;
+
+// futex bits of a role
+#define ROLE(r) (1u << (r))
+#define PLAYERS (ROLE(PLAYER1) | ROLE(PLAYER2))
+
+typedef struct {
+    move moves[2];
+    int winner;
+    long games_num;
+    long ended_games;
+    long rounds;
+    long score[2];
+
+    pthread_mutex_t mutex;
+    pthread_cond_t cond[4];
+    bool do_move[2];
+    bool show_score;
+
+    sem_t sem[4];
+
+    phase turn;
+} shared;
+
+typedef struct {
+    pthread_t tid;
+    int thread_i;
+    uint64_t random;
+
+    shared *sh;
+} threads_data;
+
+typedef struct {
+    char *name;
+    void (*player)(void *);
+    void (*judge)(void *);
+    void (*scoreboard)(void *);
+} handshake;
+
+// xorshift64*
+move random_move(threads_data *td) {
+    td->random ^= td->random >> 12;
+    td->random ^= td->random << 25;
+    td->random ^= td->random >> 27;
+    return (move)((((td->random * 0x2545F4914F6CDD1Dull) >> 32) * rps_rules.moves_num) >> 32);
+}
+
+void cond_player(void *arg) {
+    threads_data *td = (threads_data *)arg;
+    shared *sh = td->sh;
+    int p = td->thread_i - 1;
+
+    pthread_mutex_lock(&sh->mutex);
+    while (1) {
+        while (!sh->do_move[p])
+            pthread_cond_wait(&sh->cond[p], &sh->mutex);
+        if (sh->ended_games == sh->games_num)
+            break;
+        sh->moves[p] = random_move(td);
+        sh->do_move[p] = false;
+        pthread_cond_signal(&sh->cond[JUDGE]);
+    }
+    pthread_mutex_unlock(&sh->mutex);
+}
+
+void cond_judge(void *arg) {
+    threads_data *td = (threads_data *)arg;
+    shared *sh = td->sh;
+
+    pthread_mutex_lock(&sh->mutex);
+    while (sh->ended_games < sh->games_num) {
+        sh->do_move[PLAYER1] = sh->do_move[PLAYER2] = true;
+        pthread_cond_signal(&sh->cond[PLAYER1]);
+        pthread_cond_signal(&sh->cond[PLAYER2]);
+        while (sh->do_move[PLAYER1] || sh->do_move[PLAYER2])
+            pthread_cond_wait(&sh->cond[JUDGE], &sh->mutex);
+
+        sh->rounds++;
+        if ((sh->winner = morra_result(&rps_rules, sh->moves[PLAYER1], sh->moves[PLAYER2])) >= 0) {
+            sh->ended_games++;
+            sh->show_score = true;
+            pthread_cond_signal(&sh->cond[SCOREBOARD]);
+            while (sh->show_score)
+                pthread_cond_wait(&sh->cond[JUDGE], &sh->mutex);
+        }
+    }
+    sh->do_move[PLAYER1] = sh->do_move[PLAYER2] = true;
+    pthread_cond_signal(&sh->cond[PLAYER1]);
+    pthread_cond_signal(&sh->cond[PLAYER2]);
+    pthread_mutex_unlock(&sh->mutex);
+}
+
+void cond_scoreboard(void *arg) {
+    threads_data *td = (threads_data *)arg;
+    shared *sh = td->sh;
+
+    pthread_mutex_lock(&sh->mutex);
+    for (long shown = 0; shown < sh->games_num; shown++) {
+        while (!sh->show_score)
+            pthread_cond_wait(&sh->cond[SCOREBOARD], &sh->mutex);
+        sh->score[sh->winner]++;
+        sh->show_score = false;
+        pthread_cond_signal(&sh->cond[JUDGE]);
+    }
+    pthread_mutex_unlock(&sh->mutex);
+}
+
+void sem_player(void *arg) {
+    threads_data *td = (threads_data *)arg;
+    shared *sh = td->sh;
+    int p = td->thread_i - 1;
+
+    while (1) {
+        sem_wait(&sh->sem[p]);
+        if (sh->ended_games == sh->games_num)
+            break;
+        sh->moves[p] = random_move(td);
+        sem_post(&sh->sem[JUDGE]);
+    }
+}
+
+void sem_judge(void *arg) {
+    threads_data *td = (threads_data *)arg;
+    shared *sh = td->sh;
+
+    while (sh->ended_games < sh->games_num) {
+        sem_post(&sh->sem[PLAYER1]);
+        sem_post(&sh->sem[PLAYER2]);
+        sem_wait(&sh->sem[JUDGE]);
+        sem_wait(&sh->sem[JUDGE]);
+
+        sh->rounds++;
+        if ((sh->winner = morra_result(&rps_rules, sh->moves[PLAYER1], sh->moves[PLAYER2])) >= 0) {
+            sh->ended_games++;
+            sem_post(&sh->sem[SCOREBOARD]);
+            sem_wait(&sh->sem[JUDGE]);
+        }
+    }
+    sem_post(&sh->sem[PLAYER1]);
+    sem_post(&sh->sem[PLAYER2]);
+}
+
+void sem_scoreboard(void *arg) {
+    threads_data *td = (threads_data *)arg;
+    shared *sh = td->sh;
+
+    for (long shown = 0; shown < sh->games_num; shown++) {
+        sem_wait(&sh->sem[SCOREBOARD]);
+        sh->score[sh->winner]++;
+        sem_post(&sh->sem[JUDGE]);
+    }
+}
+
+void futex_player(void *arg) {
+    threads_data *td = (threads_data *)arg;
+    shared *sh = td->sh;
+    uint32_t round = 0;
+
+    while (1) {
+        phase_wait_for(&sh->turn, round + MOVES, ROLE(td->thread_i - 1));
+        if (sh->ended_games == sh->games_num)
+            break;
+        sh->moves[td->thread_i - 1] = random_move(td);
+        phase_add(&sh->turn, 1, ROLE(JUDGE));
+        round += ROUND_STATES;
+    }
+}
+
+void futex_judge(void *arg) {
+    threads_data *td = (threads_data *)arg;
+    shared *sh = td->sh;
+    uint32_t round = 0;
+
+    while (sh->ended_games < sh->games_num) {
+        phase_wait_for(&sh->turn, round + START, ROLE(JUDGE));
+        phase_set(&sh->turn, round + MOVES, PLAYERS);
+        phase_wait_for(&sh->turn, round + JUDGING, ROLE(JUDGE));
+
+        sh->rounds++;
+        if ((sh->winner = morra_result(&rps_rules, sh->moves[PLAYER1], sh->moves[PLAYER2])) >= 0) {
+            sh->ended_games++;
+            phase_set(&sh->turn, round + SCORING, ROLE(SCOREBOARD));
+        }
+        else
+            phase_set(&sh->turn, round + ROUND_STATES + START, ROLE(JUDGE));
+        round += ROUND_STATES;
+    }
+    phase_wait_for(&sh->turn, round + START, ROLE(JUDGE));
+    phase_set(&sh->turn, round + MOVES, PLAYERS);
+}
+
+void futex_scoreboard(void *arg) {
+    threads_data *td = (threads_data *)arg;
+    shared *sh = td->sh;
+    uint32_t value = START;
+
+    for (long shown = 0; shown < sh->games_num; shown++) {
+        while (value % ROUND_STATES != SCORING)
+            value = phase_wait(&sh->turn, value, ROLE(SCOREBOARD));
+        sh->score[sh->winner]++;
+        value += ROUND_STATES - SCORING + START;
+        phase_set(&sh->turn, value, ROLE(JUDGE));
+    }
+}
+
+handshake handshakes[] = {
+    { "cond", cond_player, cond_judge, cond_scoreboard },
+    { "sem", sem_player, sem_judge, sem_scoreboard },
+    { "futex", futex_player, futex_judge, futex_scoreboard },
+};
+
+void init_shared(shared *sh, long games_num) {
+    sh->games_num = games_num;
+    sh->ended_games = 0;
+    sh->rounds = 0;
+    sh->score[0] = sh->score[1] = 0;
+
+    pthread_mutex_init(&sh->mutex, NULL);
+    for (int i = 0; i < 4; i++) {
+        pthread_cond_init(&sh->cond[i], NULL);
+        sem_init(&sh->sem[i], 0, 0);
+    }
+    sh->do_move[0] = sh->do_move[1] = false;
+    sh->show_score = false;
+
+    phase_init(&sh->turn, START);
+}
+
+void destroy_shared(shared *sh) {
+    pthread_mutex_destroy(&sh->mutex);
+    for (int i = 0; i < 4; i++) {
+        pthread_cond_destroy(&sh->cond[i]);
+        sem_destroy(&sh->sem[i]);
+    }
+}
+
+void run(handshake *h, long games_num) {
+    void (*roles[4])(void *) = { h->player, h->player, h->judge, h->scoreboard };
+    threads_data td[4];
+    shared sh;
+    struct timespec start, end;
+    double ns;
+    int err;
+
+    init_shared(&sh, games_num);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < 4; i++) {
+        td[i].thread_i = i + 1;
+        td[i].random = (uint64_t)time(NULL) * 0x9E3779B97F4A7C15ull + i + 1;
+        td[i].sh = &sh;
+        if ((err = pthread_create(&td[i].tid, NULL, (void *)roles[i], &td[i])) != 0) {
+            fprintf(stderr, "Error in pthread_create: %d\n", err);
+            exit(1);
+        }
+    }
+
+    // waiting for threads to terminate
+    for (int i = 0; i < 4; i++) {
+        if ((err = pthread_join(td[i].tid, NULL)) != 0) {
+            fprintf(stderr, "Error in pthread_join: %d\n", err);
+            exit(1);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+    printf("%-6s %10ld games %10ld rounds %10.0f ns/game %10.0f ns/round\n", h->name, games_num, sh.rounds,
+           ns / games_num, ns / sh.rounds);
+
+    if (sh.score[0] + sh.score[1] != games_num)
+        fprintf(stderr, "%s: %ld games scored instead of %ld\n", h->name, sh.score[0] + sh.score[1], games_num);
+
+    destroy_shared(&sh);
+}
+
+int main(int argc, char **argv) {
+    long games_num = 1000000;
+    char *str_end;
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [number of games]\n", argv[0]);
+        exit(1);
+    }
+    if (argc == 2) {
+        games_num = strtol(argv[1], &str_end, 10);
+        if (*str_end != '\0' || games_num <= 0) {
+            fprintf(stderr, "Invalid input\n");
+            exit(1);
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(handshakes) / sizeof(handshakes[0]); i++)
+        run(&handshakes[i], games_num);
+
+    exit(0);
+}
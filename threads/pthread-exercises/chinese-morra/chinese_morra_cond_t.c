@@ -14,17 +14,17 @@
 
 #include <stdlib.h>
 #include <stdio.h>
-#include <string.h>
 #include <stdbool.h>
 #include <time.h>
 #include <pthread.h>
 
-typedef enum { PLAYER1, PLAYER2, JUDGE, SCOREBOARD } threads_name;
+#include "../../common/lockprof.h"
+#include "morra_rules.h"
 
-char *moves_type[3] = {"rock", "paper", "scissors"};
+typedef enum { PLAYER1, PLAYER2, JUDGE, SCOREBOARD } threads_name;
 
 typedef struct {
-    char *moves[2];
+    move moves[2];
     int winner;
     int games_num;
     int ended_games;
@@ -61,6 +61,13 @@ void init_shared(shared *sh, int games_num) {
         }
     }
 
+    // roles of the lock profiler (lockprof.h)
+    LOCKPROF_NAME(&sh->mutex, "mutex");
+    LOCKPROF_NAME(&sh->cond[PLAYER1], "cond[PLAYER1]");
+    LOCKPROF_NAME(&sh->cond[PLAYER2], "cond[PLAYER2]");
+    LOCKPROF_NAME(&sh->cond[JUDGE], "cond[JUDGE]");
+    LOCKPROF_NAME(&sh->cond[SCOREBOARD], "cond[SCOREBOARD]");
+
     sh->do_move[0] = sh->do_move[1] = false;
     sh->show_score = false;  
 }
@@ -94,8 +101,8 @@ void player(void *arg) {
             break;            
         }
 
-        td->sh->moves[td->thread_i - 1] = moves_type[rand() % 3];
-        printf("P%d -> %s\n", td->thread_i, td->sh->moves[td->thread_i - 1]);            
+        td->sh->moves[td->thread_i - 1] = rand() % rps_rules.moves_num;
+        printf("P%d -> %s\n", td->thread_i, moves_type[td->sh->moves[td->thread_i - 1]]);            
 
         // the players have made their own move
         td->sh->do_move[td->thread_i - 1] = false;
@@ -108,19 +115,9 @@ void player(void *arg) {
     }
 }
 
-int checkWinner(char *P1_move, char *P2_move) {
-    // draw game
-    if (strcmp(P1_move, P2_move) == 0)
-        return -1;
-
-    // P1 won
-    if (strcmp(P1_move, moves_type[0]) == 0 && strcmp(P2_move, moves_type[2]) == 0 ||
-        strcmp(P1_move, moves_type[1]) == 0 && strcmp(P2_move, moves_type[0]) == 0 ||
-        strcmp(P1_move, moves_type[2]) == 0 && strcmp(P2_move, moves_type[1]) == 0)
-        return 0;
-
-    // P2 won
-    return 1;
+// -1 for a draw, otherwise the index of the winner
+int checkWinner(move P1_move, move P2_move) {
+    return morra_result(&rps_rules, P1_move, P2_move);
 }
 
 void judge(void *arg) {
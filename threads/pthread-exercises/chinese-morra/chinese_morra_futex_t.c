@@ -0,0 +1,223 @@
+/**
+ *  The program takes the number of games as input and manages a series of games between
+ *  two virtual players P1 and P2 who play chinese morra. The program creates: two threads
+ *  P1 and P2 which represent the players, a judge thread and a scoreboard thread.
+ *  The threads share a data structure, which contains the data for each game to operate,
+ *  and are coordinated via a single phase word (phase.h) instead of a mutex and a condition
+ *  var per role: every round takes ROUND_STATES values of the word,
+ *  -   START: the judge announces the game and moves the word to MOVES;
+ *  -   MOVES: the players make their move and add 1 each, the second one reaches JUDGING;
+ *  -   JUDGING: the judge checks the moves, moves the word to SCORING if there is a winner
+ *      or to the START of the next round if the game is drawn (the judge raises the same game);
+ *  -   SCORING: the scoreboard shows the partial score and moves the word to the next START.
+ *  At the end of all games, the scoreboard is in charge of show the final score and
+ *  the final winner.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "morra_rules.h"
+#include "../../common/phase.h"
+
+#define ROUND_STATES 8
+
+typedef enum { PLAYER1, PLAYER2, JUDGE, SCOREBOARD } threads_name;
+
+typedef enum { START, MOVES, JUDGING = MOVES + 2, SCORING } round_state;
+
+// futex bits of a role
+#define ROLE(r) (1u << (r))
+#define PLAYERS (ROLE(PLAYER1) | ROLE(PLAYER2))
+
+typedef struct {
+    move moves[2];
+    int winner;
+    int games_num;
+    int ended_games;
+
+    phase turn;
+} shared;
+
+typedef struct {
+    pthread_t tid;
+    int thread_i;
+
+    shared *sh;
+} threads_data;
+
+void init_shared(shared *sh, int games_num) {
+    sh->winner = -1;
+    sh->games_num = games_num;
+    sh->ended_games = 0;
+
+    phase_init(&sh->turn, START);
+}
+
+void destroy_shared(shared *sh) {
+    free(sh);
+}
+
+void player(void *arg) {
+    threads_data *td = (threads_data *)arg;
+    uint32_t round = 0;
+
+    while (1) {
+        // the players await the judge
+        phase_wait_for(&td->sh->turn, round + MOVES, ROLE(td->thread_i - 1));
+
+        // all games have been played
+        if (td->sh->ended_games == td->sh->games_num)
+            break;
+
+        td->sh->moves[td->thread_i - 1] = rand() % rps_rules.moves_num;
+        printf("P%d -> %s\n", td->thread_i, moves_type[td->sh->moves[td->thread_i - 1]]);
+
+        // the players have made their own move
+        phase_add(&td->sh->turn, 1, ROLE(JUDGE));
+        round += ROUND_STATES;
+    }
+}
+
+// -1 for a draw, otherwise the index of the winner
+int checkWinner(move P1_move, move P2_move) {
+    return morra_result(&rps_rules, P1_move, P2_move);
+}
+
+void judge(void *arg) {
+    threads_data *td = (threads_data *)arg;
+    uint32_t round = 0;
+
+    while (td->sh->ended_games < td->sh->games_num) {
+        // the previous game is over
+        phase_wait_for(&td->sh->turn, round + START, ROLE(JUDGE));
+
+        printf("\nGame %d)\n", td->sh->ended_games + 1);
+
+        // wake up the players
+        phase_set(&td->sh->turn, round + MOVES, PLAYERS);
+
+        // wait for both players moves
+        phase_wait_for(&td->sh->turn, round + JUDGING, ROLE(JUDGE));
+
+        // check if there is a winner or if it is a draw
+        td->sh->winner = checkWinner(td->sh->moves[PLAYER1], td->sh->moves[PLAYER2]);
+
+        if (td->sh->winner >= 0) {  // there is a winner
+            // the judge moves on to the next game
+            td->sh->ended_games++;
+
+            // wake up the scoreboard to show the score
+            phase_set(&td->sh->turn, round + SCORING, ROLE(SCOREBOARD));
+        }
+        else {  // it's a draw
+            printf("Draw\n");
+            phase_set(&td->sh->turn, round + ROUND_STATES + START, ROLE(JUDGE));
+        }
+
+        round += ROUND_STATES;
+    }
+
+    // warns players that the match is over, once the last score is shown
+    phase_wait_for(&td->sh->turn, round + START, ROLE(JUDGE));
+    phase_set(&td->sh->turn, round + MOVES, PLAYERS);
+}
+
+void scoreboard(void *arg) {
+    threads_data *td = (threads_data *)arg;
+    int score[2] = {0};
+    uint32_t value = START;
+
+    for (int shown = 0; shown < td->sh->games_num; shown++) {
+        // the scoreboard awaits the judge
+        while (value % ROUND_STATES != SCORING)
+            value = phase_wait(&td->sh->turn, value, ROLE(SCOREBOARD));
+
+        // update the score of the winner of the last game
+        score[td->sh->winner]++;
+
+        printf("Partial score:\n");
+        printf("P1 = %d, P2 = %d\n", score[0], score[1]);
+
+        // the judge regains control
+        value += ROUND_STATES - SCORING + START;
+        phase_set(&td->sh->turn, value, ROLE(JUDGE));
+    }
+
+    printf("\nFinal score:\n");
+    printf("P1 = %d, P2 = %d\n", score[0], score[1]);
+    if (score[0] == score[1])
+        printf("Draw game\n\n");
+    else {
+        printf("Final winner of the match is ");
+        if (score[0] > score[1])
+            printf("P1\n\n");
+        else
+            printf("P2\n\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    // check parameters number
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <number of matches>\n", argv[0]);
+        exit(1);
+    }
+
+    char *str_end1;
+    int games_num = (int)strtol(argv[1], &str_end1, 10);
+
+    // check parameter
+    if ((*str_end1 != '\0' || games_num <= 0)) {
+        fprintf(stderr, "Invalid input\n");
+        exit(1);
+    }
+
+    threads_data td[4];
+    shared *sh = malloc(sizeof(shared));
+    int err;
+    srand(time(NULL));
+
+    init_shared(sh, games_num);
+
+    // init and create threads
+    for (int i = 0; i < 4; i++)
+        td[i].sh = sh;
+
+    td[0].thread_i = 1;
+    if ((err = pthread_create(&td[0].tid, NULL, (void *)player, &td[0])) != 0) {
+        fprintf(stderr, "Error in pthread_create: %d\n", err);
+        exit(1);
+    }
+
+    td[1].thread_i = 2;
+    if ((err = pthread_create(&td[1].tid, NULL, (void *)player, &td[1])) != 0) {
+        fprintf(stderr, "Error in pthread_create: %d\n", err);
+        exit(1);
+    }
+
+    if ((err = pthread_create(&td[2].tid, NULL, (void *)judge, &td[2])) != 0) {
+        fprintf(stderr, "Error in pthread_create: %d\n", err);
+        exit(1);
+    }
+
+    if ((err = pthread_create(&td[3].tid, NULL, (void *)scoreboard, &td[3])) != 0) {
+        fprintf(stderr, "Error in pthread_create: %d\n", err);
+        exit(1);
+    }
+
+    // waiting for threads to terminate
+    for (int i = 0; i < 4; i++) {
+        if ((err = pthread_join(td[i].tid, NULL)) != 0) {
+            fprintf(stderr, "Error in pthread_join: %d\n", err);
+            exit(1);
+        }
+    }
+
+    destroy_shared(sh);
+
+    exit(0);
+}
@@ -14,17 +14,17 @@
 
 #include <stdlib.h>
 #include <stdio.h>
-#include <string.h>
 #include <time.h>
 #include <pthread.h>
 #include <semaphore.h>
 
-typedef enum { PLAYER1, PLAYER2, JUDGE, SCOREBOARD } threads_name;
+#include "../../common/lockprof.h"
+#include "morra_rules.h"
 
-char *moves_type[3] = {"rock", "paper", "scissors"};
+typedef enum { PLAYER1, PLAYER2, JUDGE, SCOREBOARD } threads_name;
 
 typedef struct {
-    char *moves[2];
+    move moves[2];
     int winner;
     int games_num;
     int ended_games;
@@ -62,6 +62,12 @@ void init_shared(shared *sh, int games_num) {
         fprintf(stderr, "Error in sem_init: %d\n", err);
         return;
     }    
+
+    // roles of the lock profiler (lockprof.h)
+    LOCKPROF_NAME(&sh->sem[PLAYER1], "sem[PLAYER1]");
+    LOCKPROF_NAME(&sh->sem[PLAYER2], "sem[PLAYER2]");
+    LOCKPROF_NAME(&sh->sem[JUDGE], "sem[JUDGE]");
+    LOCKPROF_NAME(&sh->sem[SCOREBOARD], "sem[SCOREBOARD]");
 }
 
 void destroy_shared(shared *sh) {
@@ -83,8 +89,8 @@ void player(void *arg) {
         if (td->sh->ended_games == td->sh->games_num)
             break;
 
-        td->sh->moves[td->thread_i - 1] = moves_type[rand() % 3];
-        printf("P%d -> %s\n", td->thread_i, td->sh->moves[td->thread_i - 1]);
+        td->sh->moves[td->thread_i - 1] = rand() % rps_rules.moves_num;
+        printf("P%d -> %s\n", td->thread_i, moves_type[td->sh->moves[td->thread_i - 1]]);
 
         // the players have made their own move
         if ((err = sem_post(&td->sh->sem[JUDGE])) != 0)
@@ -92,19 +98,9 @@ void player(void *arg) {
     }
 }
 
-int checkWinner(char *P1_move, char *P2_move) {
-    // draw game
-    if (strcmp(P1_move, P2_move) == 0)
-        return -1;
-
-    // P1 won
-    if (strcmp(P1_move, moves_type[0]) == 0 && strcmp(P2_move, moves_type[2]) == 0 ||
-        strcmp(P1_move, moves_type[1]) == 0 && strcmp(P2_move, moves_type[0]) == 0 ||
-        strcmp(P1_move, moves_type[2]) == 0 && strcmp(P2_move, moves_type[1]) == 0)
-        return 0;
-
-    // P2 won
-    return 1;
+// -1 for a draw, otherwise the index of the winner
+int checkWinner(move P1_move, move P2_move) {
+    return morra_result(&rps_rules, P1_move, P2_move);
 }
 
 void judge(void *arg) {
@@ -0,0 +1,413 @@
+/**
+ *  The program takes the number of matches and the number of games of each match as input
+ *  and plays a tournament of chinese morra between player strategies, to compare them:
+ *  -   random: a uniformly random move;
+ *  -   frequency: the move that beats the most frequent move of the opponent;
+ *  -   markov: the move that beats the most frequent successor of the last move of the
+ *      opponent, counted in a table of its transitions.
+ *  Every match is between two different strategies, all the ordered pairs in turn, and its
+ *  games follow the rule of the judge: a drawn round is played again.
+ *  The matches are independent and run on a pool of worker threads (-j, one per CPU by
+ *  default). The state of the matches (random generator, last moves, move counts) is kept in
+ *  arrays indexed by match rather than in a struct per match, and the matches are grouped in
+ *  tasks of TASK_MATCHES. Every worker owns a range of tasks, packed in an atomic 64-bit word:
+ *  it takes the tasks from the start of its range, and when the range is empty it steals the
+ *  second half of the largest range of the other workers, with a compare-and-swap on both
+ *  sides, so no lock is taken.
+ *  Every worker keeps the standings of its matches and at the end adds them to the global
+ *  standings with atomic increments, then the standings of every strategy are printed.
+ *  With -l the game is rock-paper-scissors-lizard-Spock.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "morra_rules.h"
+
+#define TASK_MATCHES 16
+#define MAX_WORKERS 256
+#define NO_MOVE 0xFF
+
+typedef enum { RANDOM, FREQUENCY, MARKOV, STRATEGIES_NUM } strategy;
+
+char *strategies_name[STRATEGIES_NUM] = {"random", "frequency", "markov"};
+
+typedef enum { MATCHES_WON, MATCHES_DRAWN, MATCHES_LOST, GAMES_WON, GAMES_LOST, STANDINGS_FIELDS } standings_field;
+
+// per-match state, side s of match m observes the moves of side 1 - s
+typedef struct {
+    uint64_t *random;
+    move *last[2];
+    uint32_t *counts[2];        // matches * MAX_MOVES
+    uint32_t *transitions[2];   // matches * MAX_MOVES * MAX_MOVES
+} matches_state;
+
+typedef struct {
+    const morra_rules *rules;
+    move beaten_by[MAX_MOVES];
+    strategy pairs[STRATEGIES_NUM * (STRATEGIES_NUM - 1)][2];
+    int pairs_num;
+
+    long matches_num;
+    long games_num;
+    long tasks_num;
+    matches_state state;
+
+    _Atomic long standings[STRATEGIES_NUM][STANDINGS_FIELDS];
+    _Atomic long rounds;
+} tournament;
+
+typedef struct thread_data {
+    // the range of tasks [low, high) as low << 32 | high, alone in its cache line
+    _Alignas(64) _Atomic uint64_t tasks;
+    pthread_t tid;
+    int thread_i;
+    int workers_num;
+    long standings[STRATEGIES_NUM][STANDINGS_FIELDS];
+    long rounds;
+
+    tournament *t;
+    struct thread_data *workers;
+} thread_data;
+
+uint64_t pack_range(uint32_t low, uint32_t high) {
+    return (uint64_t)low << 32 | high;
+}
+
+// xorshift64*
+uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1Dull;
+}
+
+void init_tournament(tournament *t, const morra_rules *rules, long matches_num, long games_num) {
+    int n = rules->moves_num;
+    uint64_t seed = (uint64_t)time(NULL) * 0x9E3779B97F4A7C15ull;
+
+    t->rules = rules;
+    t->matches_num = matches_num;
+    t->games_num = games_num;
+    t->tasks_num = (matches_num + TASK_MATCHES - 1) / TASK_MATCHES;
+
+    // a move that beats each move
+    for (int m = 0; m < n; m++) {
+        for (int x = 0; x < n; x++) {
+            if (morra_result(rules, x, m) == 0) {
+                t->beaten_by[m] = x;
+                break;
+            }
+        }
+    }
+
+    t->pairs_num = 0;
+    for (int a = 0; a < STRATEGIES_NUM; a++) {
+        for (int b = 0; b < STRATEGIES_NUM; b++) {
+            if (a != b) {
+                t->pairs[t->pairs_num][0] = a;
+                t->pairs[t->pairs_num][1] = b;
+                t->pairs_num++;
+            }
+        }
+    }
+
+    t->state.random = malloc(matches_num * sizeof(uint64_t));
+    for (long m = 0; m < matches_num; m++)
+        t->state.random[m] = (seed ^ (m * 0xBF58476D1CE4E5B9ull)) | 1;
+    for (int s = 0; s < 2; s++) {
+        t->state.last[s] = malloc(matches_num * sizeof(move));
+        memset(t->state.last[s], NO_MOVE, matches_num * sizeof(move));
+        t->state.counts[s] = calloc(matches_num * MAX_MOVES, sizeof(uint32_t));
+        t->state.transitions[s] = calloc(matches_num * MAX_MOVES * MAX_MOVES, sizeof(uint32_t));
+    }
+
+    for (int i = 0; i < STRATEGIES_NUM; i++) {
+        for (int f = 0; f < STANDINGS_FIELDS; f++)
+            atomic_init(&t->standings[i][f], 0);
+    }
+    atomic_init(&t->rounds, 0);
+}
+
+void destroy_tournament(tournament *t) {
+    free(t->state.random);
+    for (int s = 0; s < 2; s++) {
+        free(t->state.last[s]);
+        free(t->state.counts[s]);
+        free(t->state.transitions[s]);
+    }
+}
+
+// the most frequent of n counts, or NO_MOVE if they are all 0
+move most_frequent(const uint32_t *counts, int n) {
+    move best = NO_MOVE;
+    uint32_t max = 0;
+
+    for (int i = 0; i < n; i++) {
+        if (counts[i] > max) {
+            max = counts[i];
+            best = i;
+        }
+    }
+    return best;
+}
+
+move choose_move(tournament *t, strategy st, long m, int side) {
+    matches_state *ms = &t->state;
+    int n = t->rules->moves_num;
+    move predicted = NO_MOVE;
+    move opponent_last = ms->last[1 - side][m];
+
+    switch (st) {
+    case FREQUENCY:
+        predicted = most_frequent(&ms->counts[side][m * MAX_MOVES], n);
+        break;
+    case MARKOV:
+        if (opponent_last != NO_MOVE)
+            predicted = most_frequent(&ms->transitions[side][(m * MAX_MOVES + opponent_last) * MAX_MOVES], n);
+        break;
+    default:
+        break;
+    }
+
+    // without a prediction the move is random
+    if (predicted == NO_MOVE)
+        return (move)(((next_random(&ms->random[m]) >> 32) * n) >> 32);
+    return t->beaten_by[predicted];
+}
+
+// every side learns the move of the other
+void observe(tournament *t, long m, const move moves[2]) {
+    matches_state *ms = &t->state;
+
+    for (int side = 0; side < 2; side++) {
+        move opponent = moves[1 - side];
+        move opponent_last = ms->last[1 - side][m];
+
+        ms->counts[side][m * MAX_MOVES + opponent]++;
+        if (opponent_last != NO_MOVE)
+            ms->transitions[side][(m * MAX_MOVES + opponent_last) * MAX_MOVES + opponent]++;
+    }
+    ms->last[0][m] = moves[0];
+    ms->last[1][m] = moves[1];
+}
+
+void play_match(thread_data *td, long m) {
+    tournament *t = td->t;
+    strategy *pair = t->pairs[m % t->pairs_num];
+    long wins[2] = {0};
+    move moves[2];
+    int winner;
+
+    for (long games = 0; games < t->games_num;) {
+        moves[0] = choose_move(t, pair[0], m, 0);
+        moves[1] = choose_move(t, pair[1], m, 1);
+        observe(t, m, moves);
+        td->rounds++;
+
+        // a drawn round is played again
+        if ((winner = morra_result(t->rules, moves[0], moves[1])) >= 0) {
+            wins[winner]++;
+            games++;
+        }
+    }
+
+    for (int side = 0; side < 2; side++) {
+        long *standings = td->standings[pair[side]];
+
+        standings[GAMES_WON] += wins[side];
+        standings[GAMES_LOST] += wins[1 - side];
+        if (wins[side] > wins[1 - side])
+            standings[MATCHES_WON]++;
+        else if (wins[side] < wins[1 - side])
+            standings[MATCHES_LOST]++;
+        else
+            standings[MATCHES_DRAWN]++;
+    }
+}
+
+// takes the first task of the own range, returns -1 if it is empty
+long take_task(thread_data *td) {
+    uint64_t range = atomic_load_explicit(&td->tasks, memory_order_acquire);
+    uint32_t low, high;
+
+    do {
+        low = range >> 32;
+        high = (uint32_t)range;
+        if (low >= high)
+            return -1;
+    } while (!atomic_compare_exchange_weak_explicit(&td->tasks, &range, pack_range(low + 1, high),
+                                                    memory_order_acq_rel, memory_order_acquire));
+    return low;
+}
+
+// moves the second half of the largest range of the others in the own one, false if there is nothing left
+bool steal_tasks(thread_data *td) {
+    thread_data *workers = td->workers;
+    thread_data *victim;
+    uint64_t range;
+    uint32_t low, high, half, largest;
+
+    while (1) {
+        victim = NULL;
+        largest = 0;
+        for (int i = 0; i < td->workers_num; i++) {
+            range = atomic_load_explicit(&workers[i].tasks, memory_order_relaxed);
+            low = range >> 32;
+            high = (uint32_t)range;
+            if (&workers[i] != td && low < high && high - low > largest) {
+                largest = high - low;
+                victim = &workers[i];
+            }
+        }
+        if (victim == NULL)
+            return false;
+
+        range = atomic_load_explicit(&victim->tasks, memory_order_acquire);
+        low = range >> 32;
+        high = (uint32_t)range;
+        if (low >= high)
+            continue;
+
+        // with a single task left the thief takes it
+        half = (high - low + 1) / 2;
+        if (atomic_compare_exchange_strong_explicit(&victim->tasks, &range, pack_range(low, high - half),
+                                                    memory_order_acq_rel, memory_order_acquire)) {
+            atomic_store_explicit(&td->tasks, pack_range(high - half, high), memory_order_release);
+            return true;
+        }
+    }
+}
+
+void worker(void *arg) {
+    thread_data *td = (thread_data *)arg;
+    tournament *t = td->t;
+    long task, end;
+
+    memset(td->standings, 0, sizeof(td->standings));
+    td->rounds = 0;
+
+    do {
+        while ((task = take_task(td)) != -1) {
+            end = (task + 1) * TASK_MATCHES < t->matches_num ? (task + 1) * TASK_MATCHES : t->matches_num;
+            for (long m = task * TASK_MATCHES; m < end; m++)
+                play_match(td, m);
+        }
+    } while (steal_tasks(td));
+
+    // merge the standings without locks
+    for (int i = 0; i < STRATEGIES_NUM; i++) {
+        for (int f = 0; f < STANDINGS_FIELDS; f++)
+            atomic_fetch_add_explicit(&t->standings[i][f], td->standings[i][f], memory_order_relaxed);
+    }
+    atomic_fetch_add_explicit(&t->rounds, td->rounds, memory_order_relaxed);
+}
+
+void print_standings(tournament *t, double seconds) {
+    long games = t->matches_num * t->games_num;
+    long played, decided;
+
+    printf("%-10s %8s %8s %8s %8s %8s\n", "strategy", "matches", "won", "drawn", "lost", "games %");
+    for (int i = 0; i < STRATEGIES_NUM; i++) {
+        played = t->standings[i][MATCHES_WON] + t->standings[i][MATCHES_DRAWN] + t->standings[i][MATCHES_LOST];
+        decided = t->standings[i][GAMES_WON] + t->standings[i][GAMES_LOST];
+        printf("%-10s %8ld %8ld %8ld %8ld %8.2f\n", strategies_name[i], played, t->standings[i][MATCHES_WON],
+               t->standings[i][MATCHES_DRAWN], t->standings[i][MATCHES_LOST],
+               decided > 0 ? 100.0 * t->standings[i][GAMES_WON] / decided : 0.0);
+    }
+    printf("\n%ld games (%ld rounds) in %.3f s (%.0f games/s)\n", games, (long)t->rounds, seconds, games / seconds);
+}
+
+int main(int argc, char **argv) {
+    const morra_rules *rules = &rps_rules;
+    int workers_num = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    char *str_end;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "j:l")) != -1) {
+        switch (opt) {
+        case 'j':
+            workers_num = (int)strtol(optarg, &str_end, 10);
+            if (*str_end != '\0' || workers_num <= 0 || workers_num > MAX_WORKERS) {
+                fprintf(stderr, "Invalid number of workers: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'l':
+            rules = &rpsls_rules;
+            break;
+        default:
+            optind = argc;  // print the usage
+            break;
+        }
+    }
+
+    // check parameters number
+    if (argc - optind != 2) {
+        fprintf(stderr, "Usage: %s [-j workers] [-l] <number of matches> <games per match>\n", argv[0]);
+        exit(1);
+    }
+
+    long matches_num = strtol(argv[optind], &str_end, 10);
+    if (*str_end != '\0' || matches_num <= 0 || matches_num / TASK_MATCHES >= UINT32_MAX) {
+        fprintf(stderr, "Invalid input\n");
+        exit(1);
+    }
+    long games_num = strtol(argv[optind + 1], &str_end, 10);
+    if (*str_end != '\0' || games_num <= 0) {
+        fprintf(stderr, "Invalid input\n");
+        exit(1);
+    }
+
+    tournament *t = malloc(sizeof(tournament));
+    thread_data *workers = aligned_alloc(64, workers_num * sizeof(thread_data));
+    struct timespec start, end;
+    long first = 0, share;
+    int err;
+
+    init_tournament(t, rules, matches_num, games_num);
+
+    // every worker starts with an equal share of the tasks
+    for (int i = 0; i < workers_num; i++) {
+        share = (t->tasks_num - first) / (workers_num - i);
+        atomic_init(&workers[i].tasks, pack_range(first, first + share));
+        first += share;
+        workers[i].thread_i = i + 1;
+        workers[i].workers_num = workers_num;
+        workers[i].t = t;
+        workers[i].workers = workers;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < workers_num; i++) {
+        if ((err = pthread_create(&workers[i].tid, NULL, (void *)worker, &workers[i])) != 0) {
+            fprintf(stderr, "Error in pthread_create: %d\n", err);
+            exit(1);
+        }
+    }
+
+    // waiting for threads to terminate
+    for (int i = 0; i < workers_num; i++) {
+        if ((err = pthread_join(workers[i].tid, NULL)) != 0) {
+            fprintf(stderr, "Error in pthread_join: %d\n", err);
+            exit(1);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    print_standings(t, (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+
+    destroy_tournament(t);
+    free(workers);
+    free(t);
+
+    exit(0);
+}
@@ -0,0 +1,277 @@
+/**
+ * Binary log of the games of chinese morra: after a header of LOG_HEADER_SIZE bytes (the magic
+ * "MRLG", the version and the number of moves of the rules) every game takes a byte, which
+ * packs the final moves of the two players and the number of drawn rounds played before them:
+ *     byte = redraws * codes + P1_move * moves_num + P2_move,   codes = moves_num^2
+ * The redraws that do not fit in the byte (from levels - 1, levels = 256 / codes) are written
+ * as the escape level followed by the rest of the redraws as a LEB128 varint, so the records
+ * are not fixed-width: with 5 moves a game with 9 or more redraws takes more than a byte. The
+ * cost stays about a byte per game, but the offset of game i is not LOG_HEADER_SIZE + i: the
+ * index of a game is its position in the sequence of records, and reaching a game means
+ * decoding the log from the start. The winner is given by the rules.
+ * The writer fills a buffer of LOG_BUFFER_SIZE bytes while a writer thread writes the other
+ * one to the file.
+*/
+
+#ifndef MATCH_LOG_H
+#define MATCH_LOG_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#ifndef LOG_BUFFER_SIZE
+#define LOG_BUFFER_SIZE (1 << 20)
+#endif
+
+#define LOG_MAGIC "MRLG"
+#define LOG_VERSION 1
+#define LOG_HEADER_SIZE 6
+#define LOG_VARINT_MAX 10
+
+typedef struct {
+    int moves_num;
+    int codes;
+    int levels;
+} log_format;
+
+typedef struct {
+    int fd;
+    const char *path;
+    log_format format;
+
+    unsigned char *buffers[2];
+    int current;
+    size_t len;
+
+    // buffer handed to the writer thread
+    int pending;
+    size_t pending_len;
+    bool closing;
+    bool failed;
+
+    pthread_t tid;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+} match_log;
+
+static void log_format_init(log_format *format, int moves_num) {
+    format->moves_num = moves_num;
+    format->codes = moves_num * moves_num;
+    format->levels = 256 / format->codes;
+}
+
+static void log_writer_thread(void *arg) {
+    match_log *log = (match_log *)arg;
+    const unsigned char *data;
+    size_t len;
+    ssize_t n;
+    bool failed = false;
+    int err;
+
+    if ((err = pthread_mutex_lock(&log->mutex)) != 0)
+        fprintf(stderr, "Error in pthread_mutex_lock: %d\n", err);
+
+    while (1) {
+        while (log->pending_len == 0 && !log->closing) {
+            if ((err = pthread_cond_wait(&log->cond, &log->mutex)) != 0)
+                fprintf(stderr, "Error in pthread_cond_wait: %d\n", err);
+        }
+        if (log->pending_len == 0)
+            break;
+
+        data = log->buffers[log->pending];
+        len = log->pending_len;
+        if ((err = pthread_mutex_unlock(&log->mutex)) != 0)
+            fprintf(stderr, "Error in pthread_mutex_unlock: %d\n", err);
+
+        // the other buffer is being filled meanwhile
+        while (len > 0 && !failed) {
+            if ((n = write(log->fd, data, len)) < 0) {
+                fprintf(stderr, "Error in write: %s\n", log->path);
+                failed = true;
+                break;
+            }
+            data += n;
+            len -= n;
+        }
+
+        if ((err = pthread_mutex_lock(&log->mutex)) != 0)
+            fprintf(stderr, "Error in pthread_mutex_lock: %d\n", err);
+        log->failed = failed;
+        log->pending_len = 0;
+        if ((err = pthread_cond_signal(&log->cond)) != 0)
+            fprintf(stderr, "Error in pthread_cond_signal: %d\n", err);
+    }
+
+    if ((err = pthread_mutex_unlock(&log->mutex)) != 0)
+        fprintf(stderr, "Error in pthread_mutex_unlock: %d\n", err);
+}
+
+// hands the filled buffer to the writer thread, once it has written the previous one
+static void log_flush(match_log *log) {
+    int err;
+
+    if ((err = pthread_mutex_lock(&log->mutex)) != 0)
+        fprintf(stderr, "Error in pthread_mutex_lock: %d\n", err);
+    while (log->pending_len > 0) {
+        if ((err = pthread_cond_wait(&log->cond, &log->mutex)) != 0)
+            fprintf(stderr, "Error in pthread_cond_wait: %d\n", err);
+    }
+    if (log->len > 0) {
+        log->pending = log->current;
+        log->pending_len = log->len;
+        if ((err = pthread_cond_signal(&log->cond)) != 0)
+            fprintf(stderr, "Error in pthread_cond_signal: %d\n", err);
+    }
+    if ((err = pthread_mutex_unlock(&log->mutex)) != 0)
+        fprintf(stderr, "Error in pthread_mutex_unlock: %d\n", err);
+
+    log->current ^= 1;
+    log->len = 0;
+}
+
+// NULL on error
+static inline match_log *log_open(const char *path, int moves_num) {
+    match_log *log = malloc(sizeof(match_log));
+    int err;
+
+    if ((log->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        fprintf(stderr, "Error in open: %s\n", path);
+        free(log);
+        return NULL;
+    }
+    log->path = path;
+    log_format_init(&log->format, moves_num);
+
+    log->buffers[0] = malloc(LOG_BUFFER_SIZE);
+    log->buffers[1] = malloc(LOG_BUFFER_SIZE);
+    log->current = 0;
+    log->pending = 0;
+    log->pending_len = 0;
+    log->closing = false;
+    log->failed = false;
+
+    memcpy(log->buffers[0], LOG_MAGIC, 4);
+    log->buffers[0][4] = LOG_VERSION;
+    log->buffers[0][5] = (unsigned char)moves_num;
+    log->len = LOG_HEADER_SIZE;
+
+    if ((err = pthread_mutex_init(&log->mutex, NULL)) != 0)
+        fprintf(stderr, "Error in pthread_mutex_init: %d\n", err);
+    if ((err = pthread_cond_init(&log->cond, NULL)) != 0)
+        fprintf(stderr, "Error in pthread_cond_init: %d\n", err);
+    if ((err = pthread_create(&log->tid, NULL, (void *)log_writer_thread, log)) != 0) {
+        fprintf(stderr, "Error in pthread_create: %d\n", err);
+        exit(1);
+    }
+
+    return log;
+}
+
+static inline void log_game(match_log *log, int P1_move, int P2_move, long redraws) {
+    const log_format *f = &log->format;
+    unsigned char *out;
+    unsigned long rest;
+    int code = P1_move * f->moves_num + P2_move;
+
+    if (log->len > LOG_BUFFER_SIZE - 1 - LOG_VARINT_MAX)
+        log_flush(log);
+    out = log->buffers[log->current] + log->len;
+
+    if (redraws < f->levels - 1) {
+        out[0] = (unsigned char)(redraws * f->codes + code);
+        log->len++;
+        return;
+    }
+
+    // escape
+    *out++ = (unsigned char)((f->levels - 1) * f->codes + code);
+    rest = redraws - (f->levels - 1);
+    while (rest >= 0x80) {
+        *out++ = (unsigned char)(rest | 0x80);
+        rest >>= 7;
+    }
+    *out++ = (unsigned char)rest;
+    log->len = out - log->buffers[log->current];
+}
+
+// writes the last games and closes the file, returns false if the log is incomplete
+static inline bool log_close(match_log *log) {
+    bool ok;
+    int err;
+
+    log_flush(log);
+
+    if ((err = pthread_mutex_lock(&log->mutex)) != 0)
+        fprintf(stderr, "Error in pthread_mutex_lock: %d\n", err);
+    log->closing = true;
+    if ((err = pthread_cond_signal(&log->cond)) != 0)
+        fprintf(stderr, "Error in pthread_cond_signal: %d\n", err);
+    if ((err = pthread_mutex_unlock(&log->mutex)) != 0)
+        fprintf(stderr, "Error in pthread_mutex_unlock: %d\n", err);
+
+    if ((err = pthread_join(log->tid, NULL)) != 0)
+        fprintf(stderr, "Error in pthread_join: %d\n", err);
+
+    ok = !log->failed;
+    if (close(log->fd) != 0) {
+        fprintf(stderr, "Error in close: %s\n", log->path);
+        ok = false;
+    }
+
+    pthread_mutex_destroy(&log->mutex);
+    pthread_cond_destroy(&log->cond);
+    free(log->buffers[0]);
+    free(log->buffers[1]);
+    free(log);
+
+    return ok;
+}
+
+// checks the header and sets the format, returns false if data is not a log
+static inline bool log_read_header(const unsigned char *data, size_t size, log_format *format) {
+    if (size < LOG_HEADER_SIZE || memcmp(data, LOG_MAGIC, 4) != 0 || data[4] != LOG_VERSION)
+        return false;
+    if (data[5] < 2 || data[5] > 16)
+        return false;
+
+    log_format_init(format, data[5]);
+    return true;
+}
+
+// decodes the game at p, returns the next one or NULL if the game is truncated or invalid
+static inline const unsigned char *log_read_game(const log_format *f, const unsigned char *p,
+                                                 const unsigned char *end, int moves[2], long *redraws) {
+    unsigned long rest = 0;
+    int level, code, shift = 0;
+
+    level = *p / f->codes;
+    code = *p++ % f->codes;
+    if (level >= f->levels)
+        return NULL;
+    moves[0] = code / f->moves_num;
+    moves[1] = code % f->moves_num;
+
+    if (level < f->levels - 1) {
+        *redraws = level;
+        return p;
+    }
+
+    do {
+        if (p == end || shift >= 64)
+            return NULL;
+        rest |= (unsigned long)(*p & 0x7F) << shift;
+        shift += 7;
+    } while (*p++ & 0x80);
+
+    *redraws = (long)(f->levels - 1 + rest);
+    return p;
+}
+
+#endif
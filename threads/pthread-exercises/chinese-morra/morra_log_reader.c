@@ -0,0 +1,114 @@
+/**
+ *  The program takes a binary log of games written by chinese_morra_batch_t.c -o (match_log.h)
+ *  and aggregates it: the final score, the drawn rounds, the histogram of the redraws of a
+ *  game, the longest series of wins of each player and how often every pair of moves ended
+ *  a game. The log is mapped in memory and decoded in a single pass.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "morra_rules.h"
+#include "match_log.h"
+
+// games with at least REDRAWS_HIST - 1 redraws share the last bucket
+#define REDRAWS_HIST 8
+
+int main(int argc, char **argv) {
+    // check parameters number
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <log-file>\n", argv[0]);
+        exit(1);
+    }
+
+    const morra_rules *rules;
+    log_format format;
+    struct stat st;
+    const unsigned char *data, *p, *end;
+    int fd;
+
+    if ((fd = open(argv[1], O_RDONLY)) < 0) {
+        fprintf(stderr, "Error in open: %s\n", argv[1]);
+        exit(1);
+    }
+    if (fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error in stat: %s\n", argv[1]);
+        exit(1);
+    }
+    if ((data = mmap(NULL, st.st_size > 0 ? st.st_size : 1, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+        fprintf(stderr, "Error in mmap: %s\n", argv[1]);
+        exit(1);
+    }
+    if (close(fd) != 0)
+        fprintf(stderr, "Error in close\n");
+    madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+
+    if (!log_read_header(data, st.st_size, &format)) {
+        fprintf(stderr, "%s is not a log of games\n", argv[1]);
+        exit(1);
+    }
+    if (format.moves_num == rps_rules.moves_num)
+        rules = &rps_rules;
+    else if (format.moves_num == rpsls_rules.moves_num)
+        rules = &rpsls_rules;
+    else {
+        fprintf(stderr, "Unknown rules with %d moves\n", format.moves_num);
+        exit(1);
+    }
+
+    long games = 0, score[2] = {0}, draws = 0, max_redraws = 0;
+    long hist[REDRAWS_HIST] = {0};
+    long endings[MAX_MOVES][MAX_MOVES] = {{0}};
+    long streak = 0, longest[2] = {0};
+    int moves[2], winner, last_winner = -1;
+    long redraws;
+
+    p = data + LOG_HEADER_SIZE;
+    end = data + st.st_size;
+    while (p < end) {
+        if ((p = log_read_game(&format, p, end, moves, &redraws)) == NULL ||
+            (winner = morra_result(rules, moves[0], moves[1])) < 0) {
+            fprintf(stderr, "Invalid game %ld in %s\n", games + 1, argv[1]);
+            exit(1);
+        }
+
+        games++;
+        score[winner]++;
+        draws += redraws;
+        if (redraws > max_redraws)
+            max_redraws = redraws;
+        hist[redraws < REDRAWS_HIST ? redraws : REDRAWS_HIST - 1]++;
+        endings[moves[0]][moves[1]]++;
+
+        streak = winner == last_winner ? streak + 1 : 1;
+        last_winner = winner;
+        if (streak > longest[winner])
+            longest[winner] = streak;
+    }
+
+    printf("%ld games, %ld bytes (%.3f bytes/game)\n", games, (long)st.st_size,
+           games > 0 ? (double)(st.st_size - LOG_HEADER_SIZE) / games : 0.0);
+    printf("P1 = %ld, P2 = %ld (%ld draws)\n", score[0], score[1], draws);
+    printf("Longest series of wins: P1 = %ld, P2 = %ld\n", longest[0], longest[1]);
+
+    printf("\nRedraws per game (max %ld):\n", max_redraws);
+    for (int i = 0; i < REDRAWS_HIST; i++)
+        printf("%s%d: %ld\n", i == REDRAWS_HIST - 1 ? ">=" : "  ", i, hist[i]);
+
+    printf("\nEnding moves (P1 / P2):\n");
+    for (int i = 0; i < format.moves_num; i++) {
+        for (int j = 0; j < format.moves_num; j++) {
+            if (endings[i][j] > 0)
+                printf("%-8s / %-8s %ld\n", moves_type[i], moves_type[j], endings[i][j]);
+        }
+    }
+
+    munmap((void *)data, st.st_size > 0 ? st.st_size : 1);
+
+    exit(0);
+}
@@ -0,0 +1,113 @@
+/**
+ * Rules of chinese morra shared by the programs of this directory.
+ * The moves are small integers and the result of a round is read from a table indexed by
+ * P1 move * moves number + P2 move: -1 for a draw, 0 if P1 won, 1 if P2 won.
+ * Besides rock-paper-scissors there is the five moves variant rock-paper-scissors-lizard-Spock.
+ * score_rounds() scores a whole batch of rounds; with SSSE3 it takes 16 rounds at a time: a
+ * shuffle of the row offsets by the P1 moves plus the P2 moves gives the indexes, and a shuffle
+ * of the table (two for the 25 entries of the five moves variant) gives the results.
+*/
+
+#ifndef MORRA_RULES_H
+#define MORRA_RULES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MORRA_X86
+#endif
+
+typedef uint8_t move;
+
+enum { ROCK, PAPER, SCISSORS, LIZARD, SPOCK, MAX_MOVES };
+
+typedef struct {
+    int moves_num;
+    const char *const *names;
+    const int8_t *results;
+} morra_rules;
+
+static const char *const moves_type[MAX_MOVES] = {"rock", "paper", "scissors", "lizard", "Spock"};
+
+static const int8_t rps_results[3 * 3] = {
+    // rock paper scissors (P2)
+    -1,  1,  0,     // rock (P1)
+     0, -1,  1,     // paper
+     1,  0, -1,     // scissors
+};
+
+static const int8_t rpsls_results[5 * 5] = {
+    // rock paper scissors lizard Spock (P2)
+    -1,  1,  0,  0,  1,     // rock (P1)
+     0, -1,  1,  1,  0,     // paper
+     1,  0, -1,  0,  1,     // scissors
+     1,  0,  1, -1,  0,     // lizard
+     0,  1,  0,  1, -1,     // Spock
+};
+
+static const morra_rules rps_rules = { 3, moves_type, rps_results };
+static const morra_rules rpsls_rules = { 5, moves_type, rpsls_results };
+
+static inline int morra_result(const morra_rules *r, move P1_move, move P2_move) {
+    return r->results[P1_move * r->moves_num + P2_move];
+}
+
+static inline void score_rounds_scalar(const morra_rules *r, const move *p1, const move *p2, size_t n, long wins[2]) {
+    int result;
+
+    for (size_t i = 0; i < n; i++) {
+        if ((result = morra_result(r, p1[i], p2[i])) >= 0)
+            wins[result]++;
+    }
+}
+
+#ifdef MORRA_X86
+__attribute__((target("ssse3,popcnt")))
+static inline void score_rounds_ssse3(const morra_rules *r, const move *p1, const move *p2, size_t n, long wins[2]) {
+    int entries = r->moves_num * r->moves_num;
+    int8_t rows[16] = {0}, table[32] = {0};
+    size_t i = 0;
+
+    for (int m = 0; m < r->moves_num; m++)
+        rows[m] = m * r->moves_num;
+    memcpy(table, r->results, entries);
+
+    const __m128i rows_v = _mm_loadu_si128((const __m128i *)rows);
+    const __m128i low_v = _mm_loadu_si128((const __m128i *)table);
+    const __m128i high_v = _mm_loadu_si128((const __m128i *)(table + 16));
+    const __m128i fifteen = _mm_set1_epi8(15), sixteen = _mm_set1_epi8(16);
+    const __m128i p1_won = _mm_setzero_si128(), p2_won = _mm_set1_epi8(1);
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(p1 + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(p2 + i));
+        __m128i index = _mm_add_epi8(_mm_shuffle_epi8(rows_v, a), b);
+        // the indexes above 15 get the sign bit, for which the shuffle gives 0
+        __m128i result = _mm_shuffle_epi8(low_v, _mm_or_si128(index, _mm_cmpgt_epi8(index, fifteen)));
+
+        // and those below 16 become negative here
+        if (entries > 16)
+            result = _mm_or_si128(result, _mm_shuffle_epi8(high_v, _mm_sub_epi8(index, sixteen)));
+
+        wins[0] += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(result, p1_won)));
+        wins[1] += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(result, p2_won)));
+    }
+
+    score_rounds_scalar(r, p1 + i, p2 + i, n - i, wins);
+}
+#endif
+
+// adds the games won by P1 and P2 in the n rounds to wins, the other rounds are draws
+static inline void score_rounds(const morra_rules *r, const move *p1, const move *p2, size_t n, long wins[2]) {
+#ifdef MORRA_X86
+    if (__builtin_cpu_supports("ssse3") && __builtin_cpu_supports("popcnt")) {
+        score_rounds_ssse3(r, p1, p2, n, wins);
+        return;
+    }
+#endif
+    score_rounds_scalar(r, p1, p2, n, wins);
+}
+
+#endif
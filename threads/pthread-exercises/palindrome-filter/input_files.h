@@ -0,0 +1,262 @@
+/**
+ * Input files of palindrome_filter: the command line arguments can be files, directories
+ * (walked recursively) or glob patterns.
+ * The files are mapped and split in chunks of at most INPUT_CHUNK_SIZE bytes; the chunks are
+ * sorted so that the largest files are scheduled first, and the readers take them in turn
+ * with an atomic counter. A chunk owns the lines that start inside it, so its boundaries do
+ * not need to be aligned in advance.
+ * Every file keeps its statistics (lines, matches, time between the first read and the last
+ * check) to be reported at the end.
+*/
+
+#ifndef INPUT_FILES_H
+#define INPUT_FILES_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <glob.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#ifndef INPUT_CHUNK_SIZE
+#define INPUT_CHUNK_SIZE (64 << 20)
+#endif
+
+typedef struct {
+    char *path;
+    size_t size;
+    const char *map;
+
+    _Atomic uint64_t lines;
+    _Atomic uint64_t matches;
+    _Atomic uint64_t start_ns;
+    _Atomic uint64_t end_ns;
+} input_file;
+
+typedef struct {
+    input_file *file;
+    size_t start;
+    size_t end;
+} input_chunk;
+
+typedef struct {
+    input_file *files;
+    size_t files_num;
+    size_t files_size;
+
+    input_chunk *chunks;
+    size_t chunks_num;
+    _Atomic size_t next_chunk;
+} input_set;
+
+// nftw has no argument for the callback
+static input_set *walked_set;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void add_file(input_set *in, const char *path, size_t size) {
+    if (in->files_num == in->files_size) {
+        in->files_size = in->files_size == 0 ? 16 : 2 * in->files_size;
+        in->files = realloc(in->files, in->files_size * sizeof(input_file));
+    }
+
+    input_file *f = &in->files[in->files_num++];
+    f->path = strdup(path);
+    f->size = size;
+    f->map = NULL;
+    atomic_init(&f->lines, 0);
+    atomic_init(&f->matches, 0);
+    atomic_init(&f->start_ns, 0);
+    atomic_init(&f->end_ns, 0);
+}
+
+static int walk_entry(const char *path, const struct stat *statbuf, int type, struct FTW *ftw) {
+    (void)ftw;
+    if (type == FTW_F && S_ISREG(statbuf->st_mode))
+        add_file(walked_set, path, statbuf->st_size);
+    return 0;
+}
+
+static int add_path(input_set *in, const char *path) {
+    struct stat statbuf;
+
+    if (stat(path, &statbuf) == -1) {
+        fprintf(stderr, "Error in stat: %s\n", path);
+        return -1;
+    }
+
+    if (S_ISDIR(statbuf.st_mode)) {
+        walked_set = in;
+        if (nftw(path, walk_entry, 64, FTW_PHYS) == -1) {
+            fprintf(stderr, "Error in nftw: %s\n", path);
+            return -1;
+        }
+        return 0;
+    }
+
+    if (!S_ISREG(statbuf.st_mode)) {
+        fprintf(stderr, "%s is not a file\n", path);
+        return -1;
+    }
+
+    add_file(in, path, statbuf.st_size);
+    return 0;
+}
+
+// adds a file, a directory, the matches of a glob pattern or the standard input
+static int input_add(input_set *in, const char *arg) {
+    glob_t matches;
+    int ret = 0;
+
+    // the standard input is not mapped, input_stream.h reads it
+    if (strcmp(arg, "-") == 0) {
+        add_file(in, arg, 0);
+        return 0;
+    }
+
+    if (strpbrk(arg, "*?[") == NULL)
+        return add_path(in, arg);
+
+    if (glob(arg, 0, NULL, &matches) != 0) {
+        fprintf(stderr, "No match for %s\n", arg);
+        return -1;
+    }
+    for (size_t i = 0; i < matches.gl_pathc && ret == 0; i++)
+        ret = add_path(in, matches.gl_pathv[i]);
+    globfree(&matches);
+
+    return ret;
+}
+
+static int compare_chunks(const void *a, const void *b) {
+    const input_chunk *x = a, *y = b;
+
+    if (x->file->size != y->file->size)
+        return x->file->size > y->file->size ? -1 : 1;
+    if (x->file != y->file)
+        return x->file < y->file ? -1 : 1;
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+// maps the files and splits them in chunks, the largest files first unless keep_order
+static int input_map(input_set *in, bool keep_order) {
+    int fd;
+    size_t n = 0;
+    char *map;
+
+    for (size_t i = 0; i < in->files_num; i++)
+        n += (in->files[i].size + INPUT_CHUNK_SIZE - 1) / INPUT_CHUNK_SIZE;
+    in->chunks = malloc((n > 0 ? n : 1) * sizeof(input_chunk));
+    in->chunks_num = 0;
+    atomic_init(&in->next_chunk, 0);
+
+    for (size_t i = 0; i < in->files_num; i++) {
+        input_file *f = &in->files[i];
+
+        // an empty file has nothing to map
+        if (f->size == 0)
+            continue;
+
+        if ((fd = open(f->path, O_RDONLY)) == -1) {
+            fprintf(stderr, "Error in open: %s\n", f->path);
+            return -1;
+        }
+        if ((map = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+            fprintf(stderr, "Error in mmap: %s\n", f->path);
+            return -1;
+        }
+        madvise(map, f->size, MADV_SEQUENTIAL);
+        f->map = map;
+
+        // the mapping stays valid after the close
+        if (close(fd) == -1)
+            fprintf(stderr, "Error in close\n");
+
+        for (size_t start = 0; start < f->size; start += INPUT_CHUNK_SIZE) {
+            in->chunks[in->chunks_num].file = f;
+            in->chunks[in->chunks_num].start = start;
+            in->chunks[in->chunks_num].end = f->size - start > INPUT_CHUNK_SIZE ? start + INPUT_CHUNK_SIZE : f->size;
+            in->chunks_num++;
+        }
+    }
+
+    if (!keep_order)
+        qsort(in->chunks, in->chunks_num, sizeof(input_chunk), compare_chunks);
+
+    return 0;
+}
+
+// returns the next chunk to read, or NULL when all of them have been taken
+static input_chunk *input_next(input_set *in) {
+    size_t i = atomic_fetch_add(&in->next_chunk, 1);
+    uint64_t expected = 0;
+
+    if (i >= in->chunks_num)
+        return NULL;
+
+    // the first chunk of a file starts its clock
+    atomic_compare_exchange_strong(&in->chunks[i].file->start_ns, &expected, now_ns());
+    return &in->chunks[i];
+}
+
+// records the end of a check on the file, keeping the latest one
+static void input_checked(input_file *f, uint64_t matches) {
+    uint64_t now = now_ns();
+    uint64_t end = atomic_load_explicit(&f->end_ns, memory_order_relaxed);
+
+    atomic_fetch_add_explicit(&f->matches, matches, memory_order_relaxed);
+    while (end < now && !atomic_compare_exchange_weak_explicit(&f->end_ns, &end, now, memory_order_relaxed,
+                                                               memory_order_relaxed))
+        ;
+}
+
+static void input_report(input_set *in, FILE *out) {
+    uint64_t lines = 0, matches = 0, bytes = 0, first = UINT64_MAX, last = 0;
+    uint64_t start, end;
+
+    fprintf(out, "%12s %12s %14s %10s  %s\n", "lines", "matches", "bytes", "MB/s", "file");
+    for (size_t i = 0; i < in->files_num; i++) {
+        input_file *f = &in->files[i];
+        start = atomic_load(&f->start_ns);
+        end = atomic_load(&f->end_ns);
+
+        fprintf(out, "%12llu %12llu %14zu %10.1f  %s\n", (unsigned long long)atomic_load(&f->lines),
+                (unsigned long long)atomic_load(&f->matches), f->size,
+                end > start ? f->size * 1e3 / (end - start) : 0.0, f->path);
+
+        lines += atomic_load(&f->lines);
+        matches += atomic_load(&f->matches);
+        bytes += f->size;
+        if (start != 0 && start < first)
+            first = start;
+        if (end > last)
+            last = end;
+    }
+    fprintf(out, "%12llu %12llu %14llu %10.1f  total (%zu files)\n", (unsigned long long)lines,
+            (unsigned long long)matches, (unsigned long long)bytes, last > first ? bytes * 1e3 / (last - first) : 0.0,
+            in->files_num);
+}
+
+static void input_destroy(input_set *in) {
+    for (size_t i = 0; i < in->files_num; i++) {
+        if (in->files[i].map != NULL && munmap((void *)in->files[i].map, in->files[i].size) == -1)
+            fprintf(stderr, "Error in munmap\n");
+        free(in->files[i].path);
+    }
+    free(in->files);
+    free(in->chunks);
+}
+
+#endif
@@ -0,0 +1,206 @@
+/**
+ * Streaming input of palindrome_filter: with "-" as input the lines come from the standard
+ * input, that can be a pipe, instead of a mapped file.
+ * An I/O thread fills STREAM_BLOCKS large blocks in turn with read calls, so the next block is
+ * read while R splits the previous one in batches. A block holds only whole lines: the partial
+ * line at its end is copied at the beginning of the next one, which is enlarged when a single
+ * line does not fit.
+ * A block is referenced by R while it is split and by every batch made from it; the last
+ * reference released, by W when the batch goes back to the pool, lets the I/O thread refill it.
+*/
+
+#ifndef INPUT_STREAM_H
+#define INPUT_STREAM_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "input_files.h"
+#include "../../common/trace.h"
+
+#ifndef STREAM_BLOCK_SIZE
+#define STREAM_BLOCK_SIZE (8 << 20)
+#endif
+#ifndef STREAM_BLOCKS
+#define STREAM_BLOCKS 2
+#endif
+#if STREAM_BLOCKS < 2
+#error "the partial line is copied from the previous block, STREAM_BLOCKS must be at least 2"
+#endif
+
+typedef struct {
+    char *data;
+    size_t size;
+    // bytes read, and bytes of the whole lines among them
+    size_t filled;
+    size_t len;
+
+    _Atomic int refs;
+} stream_block;
+
+typedef struct {
+    pthread_t tid;
+    int fd;
+    input_file *file;
+    stream_block blocks[STREAM_BLOCKS];
+
+    // blocks filled by the I/O thread and taken by R
+    long filled_num;
+    long taken_num;
+    bool eof;
+    bool failed;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t filled;
+    pthread_cond_t released;
+} input_stream;
+
+static void stream_wait_free(input_stream *st, stream_block *blk) {
+    pthread_mutex_lock(&st->mutex);
+    while (atomic_load_explicit(&blk->refs, memory_order_acquire) != 0) {
+        TRACE_BEGIN(TRACE_WAIT, "stream.released");
+        pthread_cond_wait(&st->released, &st->mutex);
+        TRACE_END(TRACE_WAIT, "stream.released");
+    }
+    pthread_mutex_unlock(&st->mutex);
+}
+
+static void stream_io_thread(void *arg) {
+    input_stream *st = (input_stream *)arg;
+    stream_block *prev = NULL, *blk;
+    size_t carry;
+    ssize_t n = 0;
+    char *nl;
+    bool eof = false;
+
+    TRACE_THREAD("I/O");
+    atomic_store(&st->file->start_ns, now_ns());
+
+    for (long i = 0; !eof; i++) {
+        blk = &st->blocks[i % STREAM_BLOCKS];
+        stream_wait_free(st, blk);
+
+        // the partial line of the previous block goes first, with room for at least as much
+        carry = prev != NULL ? prev->filled - prev->len : 0;
+        if (carry * 2 > blk->size) {
+            free(blk->data);
+            blk->size = carry * 2;
+            blk->data = malloc(blk->size);
+        }
+        if (carry > 0)
+            memcpy(blk->data, prev->data + prev->len, carry);
+        blk->filled = carry;
+
+        while (blk->filled < blk->size) {
+            TRACE_BEGIN(TRACE_IO, "read");
+            n = read(st->fd, blk->data + blk->filled, blk->size - blk->filled);
+            TRACE_END(TRACE_IO, "read");
+            if (n == -1) {
+                if (errno == EINTR)
+                    continue;
+                fprintf(stderr, "Error in read\n");
+                st->failed = true;
+                break;
+            }
+            if (n == 0)
+                break;
+            blk->filled += n;
+        }
+        eof = blk->filled < blk->size;
+        st->file->size += blk->filled - carry;
+
+        // the last line may lack the newline
+        if (eof)
+            blk->len = blk->filled;
+        else
+            blk->len = (nl = memrchr(blk->data, '\n', blk->filled)) == NULL ? 0 : (size_t)(nl - blk->data) + 1;
+
+        // R holds the block until it is split
+        atomic_store_explicit(&blk->refs, 1, memory_order_relaxed);
+
+        pthread_mutex_lock(&st->mutex);
+        st->filled_num++;
+        st->eof = eof;
+        pthread_cond_signal(&st->filled);
+        pthread_mutex_unlock(&st->mutex);
+
+        prev = blk;
+    }
+}
+
+// returns the next filled block, or NULL at the end of the input
+static stream_block *stream_next(input_stream *st) {
+    stream_block *blk = NULL;
+
+    pthread_mutex_lock(&st->mutex);
+    while (st->taken_num == st->filled_num && !st->eof) {
+        TRACE_BEGIN(TRACE_WAIT, "stream.filled");
+        pthread_cond_wait(&st->filled, &st->mutex);
+        TRACE_END(TRACE_WAIT, "stream.filled");
+    }
+    if (st->taken_num < st->filled_num)
+        blk = &st->blocks[st->taken_num++ % STREAM_BLOCKS];
+    pthread_mutex_unlock(&st->mutex);
+
+    return blk;
+}
+
+static void stream_hold(stream_block *blk) {
+    atomic_fetch_add_explicit(&blk->refs, 1, memory_order_relaxed);
+}
+
+static void stream_release(input_stream *st, stream_block *blk) {
+    // the last reference wakes up the I/O thread
+    if (atomic_fetch_sub_explicit(&blk->refs, 1, memory_order_acq_rel) == 1) {
+        pthread_mutex_lock(&st->mutex);
+        pthread_cond_broadcast(&st->released);
+        pthread_mutex_unlock(&st->mutex);
+    }
+}
+
+static void stream_start(input_stream *st, int fd, input_file *file) {
+    int err;
+
+    st->fd = fd;
+    st->file = file;
+    st->filled_num = st->taken_num = 0;
+    st->eof = st->failed = false;
+    for (int i = 0; i < STREAM_BLOCKS; i++) {
+        st->blocks[i].size = STREAM_BLOCK_SIZE;
+        st->blocks[i].data = malloc(STREAM_BLOCK_SIZE);
+        atomic_init(&st->blocks[i].refs, 0);
+    }
+
+    pthread_mutex_init(&st->mutex, NULL);
+    pthread_cond_init(&st->filled, NULL);
+    pthread_cond_init(&st->released, NULL);
+
+    if ((err = pthread_create(&st->tid, NULL, (void *)stream_io_thread, st)) != 0) {
+        fprintf(stderr, "Error in pthread_create: %d\n", err);
+        exit(1);
+    }
+}
+
+// waits for the I/O thread, which ends with the input
+static void stream_destroy(input_stream *st) {
+    int err;
+
+    if ((err = pthread_join(st->tid, NULL)) != 0) {
+        fprintf(stderr, "Error in pthread_join: %d\n", err);
+        exit(1);
+    }
+
+    for (int i = 0; i < STREAM_BLOCKS; i++)
+        free(st->blocks[i].data);
+    pthread_mutex_destroy(&st->mutex);
+    pthread_cond_destroy(&st->filled);
+    pthread_cond_destroy(&st->released);
+}
+
+#endif
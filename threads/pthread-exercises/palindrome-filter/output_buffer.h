@@ -0,0 +1,99 @@
+/**
+ * Large output buffer written with write/writev in big chunks, used by the palindrome_filter
+ * writer instead of one stdio call per result.
+ * Data that does not fit in the free space is written together with the buffered bytes by a
+ * single writev, without being copied.
+*/
+
+#ifndef OUTPUT_BUFFER_H
+#define OUTPUT_BUFFER_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "../../common/trace.h"
+
+#define OUTPUT_BUFFER_SIZE (1 << 20)
+
+typedef struct {
+    int fd;
+    char *data;
+    size_t len;
+    int failed;
+} output_buffer;
+
+static void output_init(output_buffer *o, int fd) {
+    o->fd = fd;
+    o->data = malloc(OUTPUT_BUFFER_SIZE);
+    o->len = 0;
+    o->failed = 0;
+}
+
+// writes all the vectors, resuming after partial writes
+static int output_writev(output_buffer *o, struct iovec *iov, int iovcnt) {
+    ssize_t written;
+
+    while (iovcnt > 0) {
+        TRACE_BEGIN(TRACE_IO, "writev");
+        written = writev(o->fd, iov, iovcnt);
+        TRACE_END(TRACE_IO, "writev");
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            o->failed = 1;
+            return -1;
+        }
+        while (iovcnt > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+    return 0;
+}
+
+static int output_flush(output_buffer *o) {
+    struct iovec iov = { o->data, o->len };
+
+    if (o->len == 0 || o->failed)
+        return o->failed ? -1 : 0;
+    o->len = 0;
+    return output_writev(o, &iov, 1);
+}
+
+// appends n bytes followed by the separator sep (if not '\0')
+static int output_append(output_buffer *o, const char *p, size_t n, char sep) {
+    size_t total = n + (sep != '\0');
+
+    if (o->failed)
+        return -1;
+
+    if (o->len + total <= OUTPUT_BUFFER_SIZE) {
+        memcpy(o->data + o->len, p, n);
+        if (sep != '\0')
+            o->data[o->len + n] = sep;
+        o->len += total;
+        return 0;
+    }
+
+    // the buffered bytes and the new data leave with the same system call
+    struct iovec iov[3] = { { o->data, o->len }, { (void *)p, n }, { &sep, sep != '\0' } };
+    o->len = 0;
+    return output_writev(o, iov, 3);
+}
+
+static int output_destroy(output_buffer *o) {
+    int ret = output_flush(o);
+    free(o->data);
+    return ret;
+}
+
+#endif
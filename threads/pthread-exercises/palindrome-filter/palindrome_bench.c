@@ -0,0 +1,148 @@
+/**
+ *  Microbenchmark of the palindrome check kernels of palindrome_kernel.h.
+ *  For every line length, each kernel supported by the CPU first is checked against the
+ *  scalar kernel on palindromes with a mismatch injected at random positions, then it is
+ *  timed on a palindrome (the worst case, every byte is compared) for at least the given
+ *  number of milliseconds per measure. Before the measures, the normalized check of
+ *  palindrome_normalize.h is checked on a few lines with known results.
+ *  The output reports, for each length and kernel, the time per check and the throughput.
+*/
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "palindrome_kernel.h"
+#include "palindrome_normalize.h"
+
+#define MAX_LEN (16 << 20)
+#define CHECKS_NUM 1000
+#define CHECKS_BYTES (64 << 20)
+
+size_t lengths[] = { 8, 16, 31, 64, 127, 256, 1024, 4096, 65536, 1 << 20, 16 << 20 };
+
+// options: ignore case, alnum only, unicode
+struct {
+    const char *line;
+    normalize_opts opts;
+    bool palindrome;
+} normalize_cases[] = {
+    { "Anna", { true, false, false }, true },
+    { "A man, a plan, a canal: Panama", { true, true, false }, true },
+    { "\u00C9t\u00E9", { true, false, true }, true },
+    { "\u0391\u03B1", { true, false, true }, true },
+    // in U+04C1-U+04CE the uppercase letter is the odd one, U+04C0 pairs with U+04CF
+    { "\u04C1\u04C2", { true, false, true }, true },
+    { "\u04C2\u04C3", { true, false, true }, false },
+    { "\u04CD\u04CE", { true, false, true }, true },
+    { "\u04C0\u04CF", { true, false, true }, true },
+};
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// fills str with a random palindrome of length len
+void make_palindrome(char *str, size_t len) {
+    for (size_t i = 0; i < (len + 1) / 2; i++)
+        str[i] = str[len - i - 1] = 'a' + rand() % 26;
+}
+
+// checks the normalized check on the known lines, returns the number of mismatches
+int verify_normalize(void) {
+    int errors = 0;
+
+    for (int i = 0; i < (int)(sizeof(normalize_cases) / sizeof(normalize_cases[0])); i++) {
+        palindrome_fn fn = palindrome_normalize_init(normalize_cases[i].opts);
+        if (fn(normalize_cases[i].line, strlen(normalize_cases[i].line)) != normalize_cases[i].palindrome) {
+            fprintf(stderr, "Normalized check is wrong on \"%s\"\n", normalize_cases[i].line);
+            errors++;
+        }
+    }
+    return errors;
+}
+
+// compares the kernel with the scalar one, returns the number of mismatches
+int verify(palindrome_fn fn, char *str, size_t len) {
+    int checks = CHECKS_BYTES / len < CHECKS_NUM ? CHECKS_BYTES / len + 1 : CHECKS_NUM;
+    int errors = 0;
+    size_t pos;
+    char saved;
+
+    for (int i = 0; i < checks; i++) {
+        make_palindrome(str, len);
+        if (i % 2 == 1) {
+            pos = rand() % len;
+            saved = str[pos];
+            str[pos] = saved == 'z' ? 'a' : saved + 1;
+        }
+        if (fn(str, len) != is_palindrome_scalar(str, len))
+            errors++;
+    }
+
+    make_palindrome(str, len);
+    return errors;
+}
+
+int main(int argc, char **argv) {
+    int ms = 200;
+    char *str_end;
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: %s [milliseconds per measure]\n", argv[0]);
+        exit(1);
+    }
+    if (argc == 2) {
+        ms = (int)strtol(argv[1], &str_end, 10);
+        if (*str_end != '\0' || ms <= 0) {
+            fprintf(stderr, "Invalid input\n");
+            exit(1);
+        }
+    }
+
+    char *str = malloc(MAX_LEN);
+    volatile bool result;
+    double start, elapsed;
+    long reps;
+    int errors = 0;
+
+    srand(time(NULL));
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    palindrome_kernel_init();
+    errors += verify_normalize();
+
+    printf("%10s %8s %12s %10s\n", "length", "kernel", "ns/check", "GB/s");
+    for (int l = 0; l < (int)(sizeof(lengths) / sizeof(lengths[0])); l++) {
+        for (int k = 0; k < PALINDROME_KERNELS_NUM; k++) {
+            if (!palindrome_kernels[k].supported)
+                continue;
+
+            if (verify(palindrome_kernels[k].fn, str, lengths[l]) != 0) {
+                fprintf(stderr, "Kernel %s is wrong on length %zu\n", palindrome_kernels[k].name, lengths[l]);
+                errors++;
+            }
+
+            // double the repetitions until the measure lasts long enough
+            for (reps = 1;; reps *= 2) {
+                start = now();
+                for (long r = 0; r < reps; r++)
+                    result = palindrome_kernels[k].fn(str, lengths[l]);
+                elapsed = now() - start;
+                if (elapsed * 1000 >= ms)
+                    break;
+            }
+            (void)result;
+
+            printf("%10zu %8s %12.1f %10.2f\n", lengths[l], palindrome_kernels[k].name,
+                   elapsed * 1e9 / reps, lengths[l] * reps / elapsed / 1e9);
+        }
+    }
+
+    free(str);
+
+    exit(errors == 0 ? 0 : 1);
+}
@@ -0,0 +1,338 @@
+/**
+ * Count mode of palindrome_filter (-c): counts the distinct palindromes instead of printing
+ * every occurrence, then prints the histogram, or with -k only the K most frequent ones, as
+ * "count<TAB>string" lines.
+ * Every P thread pre-aggregates in a private open-addressing table whose keys are copied in a
+ * private arena; when the table grows past LOCAL_TABLE_MAX entries, and at the end, it is merged
+ * into a global open-addressing table shared by all the threads:
+ * -   a slot is claimed with a compare-and-swap on its hash, the key is published afterwards
+ *     with a release store, and the counts are added with atomic increments, so the merges of
+ *     different threads run concurrently;
+ * -   a merge reserves room for all its entries before starting and, when the table would be
+ *     too full, the table is doubled under the write side of a rwlock, whose read side is held
+ *     by the merges.
+ * The global table references the keys in the arenas, that are freed at the end.
+*/
+
+#ifndef PALINDROME_COUNT_H
+#define PALINDROME_COUNT_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "output_buffer.h"
+
+#define ARENA_BLOCK_SIZE (1 << 20)
+#ifndef LOCAL_TABLE_MAX
+#define LOCAL_TABLE_MAX (1 << 16)
+#endif
+#ifndef GLOBAL_TABLE_MIN
+#define GLOBAL_TABLE_MIN (1 << 16)
+#endif
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t used;
+    size_t size;
+    char data[];
+} arena_block;
+
+typedef struct {
+    arena_block *head;
+} arena;
+
+typedef struct {
+    uint64_t hash;
+    const char *key;
+    size_t len;
+    uint64_t count;
+} local_entry;
+
+typedef struct {
+    local_entry *entries;
+    size_t size;
+    size_t used;
+    arena keys;
+} local_table;
+
+typedef struct {
+    _Atomic uint64_t hash;
+    const char *_Atomic key;
+    size_t len;
+    _Atomic uint64_t count;
+} global_entry;
+
+typedef struct {
+    global_entry *entries;
+    size_t size;
+    _Atomic size_t reserved;
+
+    pthread_rwlock_t resize;
+} global_table;
+
+static char *arena_alloc(arena *a, size_t n) {
+    arena_block *b = a->head;
+    size_t size;
+
+    if (b == NULL || b->size - b->used < n) {
+        // strings longer than a block get a block of their own
+        size = n > ARENA_BLOCK_SIZE / 4 ? n : ARENA_BLOCK_SIZE;
+        b = malloc(sizeof(arena_block) + size);
+        b->used = 0;
+        b->size = size;
+        if (a->head != NULL && size != ARENA_BLOCK_SIZE) {
+            // keep filling the current block
+            b->next = a->head->next;
+            a->head->next = b;
+        }
+        else {
+            b->next = a->head;
+            a->head = b;
+        }
+    }
+
+    b->used += n;
+    return b->data + b->used - n;
+}
+
+static void arena_destroy(arena *a) {
+    arena_block *next;
+
+    for (arena_block *b = a->head; b != NULL; b = next) {
+        next = b->next;
+        free(b);
+    }
+    a->head = NULL;
+}
+
+// never 0, which marks an empty slot
+static uint64_t hash_string(const char *str, size_t len) {
+    uint64_t h = 0x9E3779B97F4A7C15ull ^ len;
+    uint64_t w;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        memcpy(&w, str + i, 8);
+        h = (h ^ w) * 0xFF51AFD7ED558CCDull;
+        h ^= h >> 32;
+    }
+    w = 0;
+    memcpy(&w, str + i, len - i);
+    h = (h ^ w) * 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 29;
+    return h == 0 ? 1 : h;
+}
+
+static void local_init(local_table *t) {
+    t->size = 1024;
+    t->used = 0;
+    t->entries = calloc(t->size, sizeof(local_entry));
+    t->keys.head = NULL;
+}
+
+static void local_grow(local_table *t) {
+    local_entry *old = t->entries;
+    size_t old_size = t->size;
+    size_t j;
+
+    t->size *= 2;
+    t->entries = calloc(t->size, sizeof(local_entry));
+    for (size_t i = 0; i < old_size; i++) {
+        if (old[i].hash == 0)
+            continue;
+        for (j = old[i].hash & (t->size - 1); t->entries[j].hash != 0; j = (j + 1) & (t->size - 1))
+            ;
+        t->entries[j] = old[i];
+    }
+    free(old);
+}
+
+static void local_add(local_table *t, const char *str, size_t len) {
+    uint64_t h = hash_string(str, len);
+    size_t i;
+    char *key;
+
+    for (i = h & (t->size - 1); t->entries[i].hash != 0; i = (i + 1) & (t->size - 1)) {
+        if (t->entries[i].hash == h && t->entries[i].len == len && memcmp(t->entries[i].key, str, len) == 0) {
+            t->entries[i].count++;
+            return;
+        }
+    }
+
+    key = arena_alloc(&t->keys, len);
+    memcpy(key, str, len);
+    t->entries[i].hash = h;
+    t->entries[i].key = key;
+    t->entries[i].len = len;
+    t->entries[i].count = 1;
+
+    if (++t->used * 2 > t->size)
+        local_grow(t);
+}
+
+static void local_destroy(local_table *t) {
+    free(t->entries);
+    arena_destroy(&t->keys);
+}
+
+static void global_init(global_table *g) {
+    int err;
+
+    g->size = GLOBAL_TABLE_MIN;
+    g->entries = calloc(g->size, sizeof(global_entry));
+    atomic_init(&g->reserved, 0);
+    if ((err = pthread_rwlock_init(&g->resize, NULL)) != 0)
+        fprintf(stderr, "Error in pthread_rwlock_init: %d\n", err);
+}
+
+static void global_destroy(global_table *g) {
+    pthread_rwlock_destroy(&g->resize);
+    free(g->entries);
+}
+
+// doubles the table until n more entries fit; the caller holds the write lock
+static void global_grow(global_table *g, size_t n) {
+    global_entry *old = g->entries;
+    size_t old_size = g->size;
+    size_t used = 0;
+    size_t j;
+
+    for (size_t i = 0; i < old_size; i++)
+        used += atomic_load_explicit(&old[i].hash, memory_order_relaxed) != 0;
+    while ((used + n) * 4 > g->size * 3)
+        g->size *= 2;
+    if (g->size == old_size)
+        return;
+
+    g->entries = calloc(g->size, sizeof(global_entry));
+    for (size_t i = 0; i < old_size; i++) {
+        uint64_t h = atomic_load_explicit(&old[i].hash, memory_order_relaxed);
+        if (h == 0)
+            continue;
+        for (j = h & (g->size - 1); atomic_load_explicit(&g->entries[j].hash, memory_order_relaxed) != 0;
+             j = (j + 1) & (g->size - 1))
+            ;
+        atomic_store_explicit(&g->entries[j].hash, h, memory_order_relaxed);
+        g->entries[j].len = old[i].len;
+        atomic_store_explicit(&g->entries[j].key, old[i].key, memory_order_relaxed);
+        atomic_store_explicit(&g->entries[j].count, old[i].count, memory_order_relaxed);
+    }
+    atomic_store(&g->reserved, used);
+    free(old);
+}
+
+// returns true if the key was not in the table yet; the caller holds the read lock
+static bool global_add(global_table *g, const local_entry *e) {
+    size_t mask = g->size - 1;
+    const char *key;
+    uint64_t h;
+
+    for (size_t i = e->hash & mask;; i = (i + 1) & mask) {
+        h = atomic_load_explicit(&g->entries[i].hash, memory_order_acquire);
+        if (h == 0) {
+            uint64_t expected = 0;
+            if (atomic_compare_exchange_strong_explicit(&g->entries[i].hash, &expected, e->hash,
+                                                        memory_order_acq_rel, memory_order_acquire)) {
+                g->entries[i].len = e->len;
+                atomic_store_explicit(&g->entries[i].count, e->count, memory_order_relaxed);
+                // the key is published last: it makes len visible to the readers
+                atomic_store_explicit(&g->entries[i].key, e->key, memory_order_release);
+                return true;
+            }
+            h = expected;
+        }
+        if (h != e->hash)
+            continue;
+
+        // the slot may have just been claimed, wait for its key
+        while ((key = atomic_load_explicit(&g->entries[i].key, memory_order_acquire)) == NULL)
+            ;
+        if (g->entries[i].len == e->len && memcmp(key, e->key, e->len) == 0) {
+            atomic_fetch_add_explicit(&g->entries[i].count, e->count, memory_order_relaxed);
+            return false;
+        }
+    }
+}
+
+// merges the local table into the global one and empties it (the keys stay in the arena)
+static void local_flush(local_table *t, global_table *g) {
+    size_t added = 0;
+    size_t n = t->used;
+
+    if (n == 0)
+        return;
+
+    // reserve room for the worst case, where all the keys are new
+    pthread_rwlock_rdlock(&g->resize);
+    while ((atomic_fetch_add(&g->reserved, n) + n) * 4 > g->size * 3) {
+        atomic_fetch_sub(&g->reserved, n);
+        pthread_rwlock_unlock(&g->resize);
+
+        pthread_rwlock_wrlock(&g->resize);
+        global_grow(g, n);
+        pthread_rwlock_unlock(&g->resize);
+
+        pthread_rwlock_rdlock(&g->resize);
+    }
+
+    for (size_t i = 0; i < t->size; i++) {
+        if (t->entries[i].hash != 0)
+            added += global_add(g, &t->entries[i]);
+    }
+
+    // give back the room of the keys that were already present
+    atomic_fetch_sub(&g->reserved, n - added);
+    pthread_rwlock_unlock(&g->resize);
+
+    memset(t->entries, 0, t->size * sizeof(local_entry));
+    t->used = 0;
+}
+
+// the bigger count first, ties broken by the string
+static int compare_entries(const void *a, const void *b) {
+    const global_entry *x = a, *y = b;
+    uint64_t cx = atomic_load(&x->count), cy = atomic_load(&y->count);
+    size_t len = x->len < y->len ? x->len : y->len;
+    int cmp;
+
+    if (cx != cy)
+        return cx > cy ? -1 : 1;
+    if ((cmp = memcmp(x->key, y->key, len)) != 0)
+        return cmp;
+    return (x->len > y->len) - (x->len < y->len);
+}
+
+// prints the top_k most frequent palindromes, or all of them when top_k is 0
+static int print_counts(global_table *g, size_t top_k, output_buffer *out) {
+    size_t n = 0;
+    char prefix[32];
+    int len;
+
+    // compact the used slots at the beginning of the table
+    for (size_t i = 0; i < g->size; i++) {
+        if (atomic_load(&g->entries[i].hash) != 0) {
+            if (i != n)
+                memcpy((void *)&g->entries[n], (void *)&g->entries[i], sizeof(global_entry));
+            n++;
+        }
+    }
+
+    qsort(g->entries, n, sizeof(global_entry), compare_entries);
+    if (top_k > 0 && top_k < n)
+        n = top_k;
+
+    for (size_t i = 0; i < n; i++) {
+        len = snprintf(prefix, sizeof(prefix), "%llu\t", (unsigned long long)atomic_load(&g->entries[i].count));
+        if (output_append(out, prefix, len, '\0') == -1 ||
+            output_append(out, g->entries[i].key, g->entries[i].len, '\n') == -1)
+            return -1;
+    }
+    return 0;
+}
+
+#endif
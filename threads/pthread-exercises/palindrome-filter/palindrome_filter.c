@@ -1,193 +1,637 @@
 /**
- *  The program takes the path of a file as input, the output consists of all the palindrome
- *  strings contained within the file.
- *  When the program starts, it creates 3 threads R, P and W which have access to a shared data
- *  structure through mutual exclusion using semaphores.
- *  The roles of the 3 threads are as follows:
- *  -   R reads the file line by line and inserts, at each iteration, the read line (the string)
- *      inside the shared data structure;
- *  -   P analyzes, at each iteration, the string inserted by R in the data structure, if the
- *      string is palindrome, P will have to wake up W to print the string;
- *  -   W prints every palindrome string found.
+ *  The program takes the paths of files as input, the output consists of all the palindrome
+ *  strings contained within the files. A path can also be a directory, whose files are read
+ *  recursively, or a glob pattern (input_files.h); with "-" the lines are read from the standard
+ *  input, which can be a pipe, in large blocks (input_stream.h).
+ *  The work is organized as a pipeline of threads R, P and W connected by bounded queues of
+ *  batches, each batch holding many lines:
+ *  -   R scans the memory-mapped files line by line, fills a batch with a view (offset and
+ *      length) of every read line and inserts it in the input queue; the files are split in
+ *      chunks taken by a pool of R threads (-r), the largest files first, while with -o a
+ *      single R reads them in the given order;
+ *  -   a pool of P threads (-j, one per CPU by default) takes the batches from the input
+ *      queue, keeps only the palindrome lines and inserts the batch in the output queue;
+ *  -   W takes the batches from the output queue and prints every palindrome string found,
+ *      in the order of the input file when -o is given; the strings are collected in a large
+ *      buffer written with a single system call when full, and the batch goes back to R as
+ *      soon as its strings are copied.
+ *  The palindrome check uses the widest SIMD kernel supported by the CPU (palindrome_kernel.h);
+ *  -i, -a and -u make it ignore the case, ignore punctuation and whitespace and fold Unicode
+ *  (UTF-8) text (palindrome_normalize.h).
+ *  The batches come from a fixed pool, which is a queue too: R waits for W to release a batch
+ *  when all of them are in flight, so the memory used does not depend on the file size.
+ *  The queues are bounded_queues (../../common/bounded_queue.h) with condition variables as sync
+ *  policy, another one can be chosen with -DBATCH_QUEUE_SYNC=QUEUE_SYNC_... and
+ *  -DBATCH_QUEUE_WAIT=QUEUE_WAIT_....
+ *  The end of the work is an end-of-stream marker that flows through the pipeline like the
+ *  batches: the last R to finish inserts it in the input queue, every P that takes it puts it
+ *  back for the others, and the last P to finish forwards it to W. "Last" is decided by an atomic
+ *  counter decremented with acquire-release ordering, so the thread that sends the marker on
+ *  sees all the work of the others, and no thread ever checks a shared flag.
+ *  With -c the P threads count the distinct palindromes instead, and the histogram (or the
+ *  -k most frequent ones) is printed at the end (palindrome_count.h).
+ *  The lines, matches and throughput of every file are printed on stderr at the end when more
+ *  than one file is read, or with -v.
+ *  With -s the program reports instead the palindromic substrings of every line, or of the whole
+ *  file with -F (palindrome_search.h).
+ *  Built with -DPERFCOUNT, the counters of every R, P and W thread are printed on stderr at the end,
+ *  per region: reading the lines, checking a batch, printing it and the pushes and pops of the
+ *  queues, waits included (../../common/perfcount.h).
+ *  Built with -DTRACE_EVENTS, the waits on the queues, their critical sections, the work of every
+ *  thread and the reads and writes are traced to trace.json, to be viewed in Perfetto
+ *  (../../common/trace.h).
 */
 
+// nftw
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 #include <pthread.h>
-#include <semaphore.h>
-#include <linux/limits.h>
 
-#define BUFFER_SIZE 4096
+#include "../../common/perfcount.h"
+#include "../../common/lockprof.h"
+#include "../../common/trace.h"
+#include "palindrome_kernel.h"
+#include "palindrome_normalize.h"
+#include "palindrome_search.h"
+#include "palindrome_count.h"
+#include "output_buffer.h"
+#include "input_files.h"
+#include "input_stream.h"
+
+#define BATCH_LINES 1024
+#define BATCH_BYTES (1 << 20)
+#define QUEUE_SIZE 64
+#define MAX_WORKERS 256
+
+// a line of a mapped file, without the trailing newline
+typedef struct {
+    size_t offset;
+    size_t len;
+} line_view;
 
-typedef enum { R, P, W } thread_i;
+// the lines of a batch all belong to the same file; the offsets are relative to data
+typedef struct {
+    long seq;
+    input_file *file;
+    const char *data;
+    // the block of the standard input holding the lines, NULL for a mapped file
+    stream_block *block;
+    int lines_num;
+    line_view lines[BATCH_LINES];
+} batch;
+
+#ifndef BATCH_QUEUE_SYNC
+#define BATCH_QUEUE_SYNC QUEUE_SYNC_COND
+#endif
+#ifndef BATCH_QUEUE_WAIT
+#define BATCH_QUEUE_WAIT QUEUE_WAIT_BLOCK
+#endif
+
+// an instance per queue, so their locks and waits are profiled and traced apart
+#define QUEUE_NAME free_queue
+#define QUEUE_TYPE batch *
+#define QUEUE_CAPACITY QUEUE_SIZE
+#define QUEUE_SYNC BATCH_QUEUE_SYNC
+#define QUEUE_WAIT BATCH_QUEUE_WAIT
+#include "../../common/bounded_queue.h"
+
+#define QUEUE_NAME input_queue
+#define QUEUE_TYPE batch *
+#define QUEUE_CAPACITY QUEUE_SIZE
+#define QUEUE_SYNC BATCH_QUEUE_SYNC
+#define QUEUE_WAIT BATCH_QUEUE_WAIT
+#include "../../common/bounded_queue.h"
+
+#define QUEUE_NAME output_queue
+#define QUEUE_TYPE batch *
+#define QUEUE_CAPACITY QUEUE_SIZE
+#define QUEUE_SYNC BATCH_QUEUE_SYNC
+#define QUEUE_WAIT BATCH_QUEUE_WAIT
+#include "../../common/bounded_queue.h"
 
 typedef struct {
-    char buffer[BUFFER_SIZE];
-    bool ended_work;
+    int readers_num;
+    int workers_num;
+    bool ordered;
+    bool count;
+    size_t top_k;
+    bool stats;
+    palindrome_fn check;
+} filter_opts;
 
-    sem_t sem[3];
+typedef struct {
+    input_set *inputs;
+    input_stream *stream;
+    filter_opts opts;
+
+    batch *batches;
+    free_queue free;
+    input_queue input;
+    output_queue output;
+    global_table counts;
+
+    // the marker is not part of the pool, it never goes back to R
+    batch end_of_stream;
+    _Atomic int readers_running;
+    _Atomic int workers_running;
+    bool write_failed;  // set by W, read after its join
 } shared;
 
 typedef struct {
     pthread_t tid;
-    FILE *file;
-    
+    int thread_i;
+    long seq;
+    local_table counts;
+
     shared *shared;
 } thread_data;
 
-void init_shared(shared *sh) {
-    sh->ended_work = false;
-
-    int err;
-    // semaphores init
-    if ((err = sem_init(&sh->sem[R], 0, 1)) != 0) {
-        fprintf(stderr, "Error in sem_init: %d\n", err);
-        return;
-    }
-    if ((err = sem_init(&sh->sem[P], 0, 0)) != 0) {
-        fprintf(stderr, "Error in sem_init: %d\n", err);
-        return;
-    }
-    if ((err = sem_init(&sh->sem[W], 0, 0)) != 0) {
-        fprintf(stderr, "Error in sem_init: %d\n", err);
-        return;
-    }
+// push and pop of a batch on the queue q, an instance of name, with their waits; QUEUE_POP
+// stores the batch in b
+#define QUEUE_PUSH(name, q, b) do { \
+    batch *pushed = (b); \
+    PERF_BEGIN("queue_push"); \
+    name##_push((q), &pushed, NULL); \
+    PERF_END("queue_push"); \
+} while (0)
+
+#define QUEUE_POP(name, q, b) \
+    (PERF_BEGIN("queue_pop"), name##_pop((q), &(b), NULL), PERF_END("queue_pop"))
+
+void init_shared(shared *sh, input_set *inputs, input_stream *stream, const filter_opts *opts) {
+    sh->inputs = inputs;
+    sh->stream = stream;
+    sh->opts = *opts;
+    sh->end_of_stream.lines_num = 0;
+    sh->write_failed = false;
+    atomic_init(&sh->readers_running, opts->readers_num);
+    atomic_init(&sh->workers_running, opts->workers_num);
+
+    free_queue_init(&sh->free);
+    input_queue_init(&sh->input);
+    output_queue_init(&sh->output);
+
+    // the pool never holds more batches than a queue can contain
+    sh->batches = malloc(QUEUE_SIZE * sizeof(batch));
+    for (int i = 0; i < QUEUE_SIZE; i++)
+        QUEUE_PUSH(free_queue, &sh->free, &sh->batches[i]);
+
+    if (opts->count)
+        global_init(&sh->counts);
 }
 
 void destroy_shared(shared *sh) {
-    for (int i = 0; i < 3; i++)
-        sem_destroy(&sh->sem[i]);
+    free_queue_destroy(&sh->free);
+    input_queue_destroy(&sh->input);
+    output_queue_destroy(&sh->output);
+    if (sh->opts.count)
+        global_destroy(&sh->counts);
+    free(sh->batches);
     free(sh);
 }
 
-void reader_thread(void *arg) {
-    thread_data *td = (thread_data *)arg;
-    char readerbuff[BUFFER_SIZE];
-    int err;
-
-    while (fgets(readerbuff, BUFFER_SIZE, td->file)) {
-        if (readerbuff[strlen(readerbuff) - 1] == '\n')
-            readerbuff[strlen(readerbuff) - 1] = '\0';
+// splits the lines that start in [start, end) of data in batches, returning their number
+uint64_t read_lines(thread_data *td, input_file *file, stream_block *block, const char *data, size_t start,
+                    size_t end, size_t data_end) {
+    const char *p = data + start;
+    const char *nl;
+    batch *b = NULL;
+    size_t batch_bytes = 0;
+    uint64_t lines = 0;
+
+    // the line across the start belongs to the previous chunk
+    if (start > 0 && data[start - 1] != '\n')
+        p = (nl = memchr(p, '\n', end - start)) == NULL ? data + end : nl + 1;
+
+    while (p < data + end) {
+        // the last line may lack the newline, and the last line of a chunk may end after it
+        if ((nl = memchr(p, '\n', data + data_end - p)) == NULL)
+            nl = data + data_end;
+
+        // wait for a free batch
+        if (b == NULL) {
+            QUEUE_POP(free_queue, &td->shared->free, b);
+            b->seq = td->seq++;
+            b->file = file;
+            b->data = data;
+            b->block = block;
+            b->lines_num = 0;
+            batch_bytes = 0;
+            if (block != NULL)
+                stream_hold(block);
+        }
 
-        // wait to be able to insert into the buffer
-        if ((err = sem_wait(&td->shared->sem[R])) != 0)
-            fprintf(stderr, "Error in sem_wait: %d\n", err);
+        b->lines[b->lines_num].offset = p - data;
+        b->lines[b->lines_num].len = nl - p;
+        b->lines_num++;
+        batch_bytes += nl - p;
+        lines++;
+        p = nl + 1;
+
+        // P can check the lines of a full batch
+        if (b->lines_num == BATCH_LINES || batch_bytes >= BATCH_BYTES) {
+            QUEUE_PUSH(input_queue, &td->shared->input, b);
+            b = NULL;
+        }
+    }
 
-        strncpy(td->shared->buffer, readerbuff, BUFFER_SIZE);
+    // the next lines may come from another file or block
+    if (b != NULL)
+        QUEUE_PUSH(input_queue, &td->shared->input, b);
 
-        // P can check the string
-        if ((err = sem_post(&td->shared->sem[P])) != 0)
-            fprintf(stderr, "Error in sem_post: %d\n", err);
-    }
+    return lines;
+}
 
-    td->shared->ended_work = true;
+// the last R out ends the input stream, after all the batches of the others
+void reader_done(thread_data *td) {
+    if (atomic_fetch_sub_explicit(&td->shared->readers_running, 1, memory_order_acq_rel) == 1)
+        QUEUE_PUSH(input_queue, &td->shared->input, &td->shared->end_of_stream);
+}
 
-    if ((err = sem_post(&td->shared->sem[P])) != 0)
-        fprintf(stderr, "Error in sem_post: %d\n", err);
+void reader_thread(void *arg) {
+    thread_data *td = (thread_data *)arg;
+    input_chunk *c;
+    uint64_t lines;
+
+    PERF_THREAD("R");
+    TRACE_THREAD("R%d", td->thread_i);
+    while ((c = input_next(td->shared->inputs)) != NULL) {
+        PERF_BEGIN("read_lines");
+        TRACE_BEGIN(TRACE_WORK, "read_lines");
+        lines = read_lines(td, c->file, NULL, c->file->map, c->start, c->end, c->file->size);
+        TRACE_END(TRACE_WORK, "read_lines");
+        PERF_END("read_lines");
+        atomic_fetch_add_explicit(&c->file->lines, lines, memory_order_relaxed);
+    }
 
-    if ((err = sem_post(&td->shared->sem[W])) != 0)
-        fprintf(stderr, "Error in sem_post: %d\n", err);  
+    reader_done(td);
 }
 
-bool is_palindrome(char *str) {
-    int i = 0;
-    while (i < strlen(str) / 2) {
-        if (str[i] != str[strlen(str) - i - 1])
-            return false;
-        i++;
+void stream_reader_thread(void *arg) {
+    thread_data *td = (thread_data *)arg;
+    input_stream *st = td->shared->stream;
+    stream_block *blk;
+    uint64_t lines;
+
+    PERF_THREAD("R");
+    TRACE_THREAD("R%d", td->thread_i);
+    while ((blk = stream_next(st)) != NULL) {
+        PERF_BEGIN("read_lines");
+        TRACE_BEGIN(TRACE_WORK, "read_lines");
+        lines = read_lines(td, st->file, blk, blk->data, 0, blk->len, blk->len);
+        TRACE_END(TRACE_WORK, "read_lines");
+        PERF_END("read_lines");
+        atomic_fetch_add_explicit(&st->file->lines, lines, memory_order_relaxed);
+
+        // the batches keep the block until W is done with them
+        stream_release(st, blk);
     }
-    return true;
+
+    reader_done(td);
 }
 
 void palindrome_thread(void *arg) {
     thread_data *td = (thread_data *)arg;
-    int err;
-
-    while (!td->shared->ended_work) {
-        // waits for insert into the buffer
-        if ((err = sem_wait(&td->shared->sem[P])) != 0)
-            fprintf(stderr, "Error in sem_wait: %d\n", err);   
-        
-        if (is_palindrome(td->shared->buffer)) {
-            // W has to print the palindrome string
-            if ((err = sem_post(&td->shared->sem[W])) != 0)
-                fprintf(stderr, "Error in sem_post: %d\n", err);
+    const char *map;
+    batch *b;
+    int matches;
+
+    PERF_THREAD("P");
+    TRACE_THREAD("P%d", td->thread_i);
+    if (td->shared->opts.count)
+        local_init(&td->counts);
+
+    while (QUEUE_POP(input_queue, &td->shared->input, b), b != &td->shared->end_of_stream) {
+        // keep only the palindrome lines, the counters are read once per batch
+        PERF_BEGIN("is_palindrome");
+        TRACE_BEGIN(TRACE_WORK, "is_palindrome");
+        map = b->data;
+        matches = 0;
+        for (int i = 0; i < b->lines_num; i++) {
+            if (td->shared->opts.check(map + b->lines[i].offset, b->lines[i].len))
+                b->lines[matches++] = b->lines[i];
         }
-        else {
-            // R can continue to read the buffer
-            if ((err = sem_post(&td->shared->sem[R])) != 0)
-                fprintf(stderr, "Error in sem_post: %d\n", err);
+        TRACE_END(TRACE_WORK, "is_palindrome");
+        PERF_END("is_palindrome");
+        b->lines_num = matches;
+        input_checked(b->file, matches);
+
+        // count them instead, W only gives the batch back to R
+        if (td->shared->opts.count) {
+            for (int i = 0; i < b->lines_num; i++)
+                local_add(&td->counts, map + b->lines[i].offset, b->lines[i].len);
+            b->lines_num = 0;
+            if (td->counts.used > LOCAL_TABLE_MAX)
+                local_flush(&td->counts, &td->shared->counts);
         }
+
+        // W has to print the palindrome strings
+        QUEUE_PUSH(output_queue, &td->shared->output, b);
     }
+
+    if (td->shared->opts.count)
+        local_flush(&td->counts, &td->shared->counts);
+
+    // the last P out forwards the marker to W, the others leave it to the remaining P threads
+    if (atomic_fetch_sub_explicit(&td->shared->workers_running, 1, memory_order_acq_rel) == 1)
+        QUEUE_PUSH(output_queue, &td->shared->output, b);
+    else
+        QUEUE_PUSH(input_queue, &td->shared->input, b);
+}
+
+void print_batch(batch *b, output_buffer *out) {
+    const char *map = b->data;
+
+    for (int i = 0; i < b->lines_num; i++) {
+        if (output_append(out, map + b->lines[i].offset, b->lines[i].len, '\n') == -1)
+            return;
+    }
+}
+
+// R can reuse the batch, and the I/O thread the block of its lines
+void release_batch(shared *sh, batch *b) {
+    if (b->block != NULL)
+        stream_release(sh->stream, b->block);
+    QUEUE_PUSH(free_queue, &sh->free, b);
 }
 
 void writer_thread(void *arg) {
     thread_data *td = (thread_data *)arg;
-    int err;
+    batch *pending[QUEUE_SIZE] = {NULL};
+    long next_seq = 0;
+    output_buffer out;
+    batch *b;
+
+    PERF_THREAD("W");
+    TRACE_THREAD("W");
+    output_init(&out, STDOUT_FILENO);
+
+    while (QUEUE_POP(output_queue, &td->shared->output, b), b != &td->shared->end_of_stream) {
+        if (!td->shared->opts.ordered) {
+            PERF_BEGIN("print_batch");
+            TRACE_BEGIN(TRACE_WORK, "print_batch");
+            print_batch(b, &out);
+            TRACE_END(TRACE_WORK, "print_batch");
+            PERF_END("print_batch");
+            release_batch(td->shared, b);
+            continue;
+        }
+
+        // at most QUEUE_SIZE batches exist, so their sequence numbers never collide
+        pending[b->seq % QUEUE_SIZE] = b;
+        while ((b = pending[next_seq % QUEUE_SIZE]) != NULL) {
+            PERF_BEGIN("print_batch");
+            TRACE_BEGIN(TRACE_WORK, "print_batch");
+            print_batch(b, &out);
+            TRACE_END(TRACE_WORK, "print_batch");
+            PERF_END("print_batch");
+            pending[next_seq % QUEUE_SIZE] = NULL;
+            next_seq++;
+            release_batch(td->shared, b);
+        }
+    }
+
+    // after an error the batches are still consumed, so R is never blocked
+    if (output_destroy(&out) == -1) {
+        fprintf(stderr, "Error in write\n");
+        td->shared->write_failed = true;
+    }
+}
 
-    while (!td->shared->ended_work) {
-        // waits to be awakened by P
-        if ((err = sem_wait(&td->shared->sem[W])) != 0)
-            fprintf(stderr, "Error in sem_wait: %d\n", err);
+// stream is NULL unless the lines come from the standard input; -1 if the output could not
+// be written
+int run_pipeline(input_set *inputs, input_stream *stream, const filter_opts *opts) {
+    int readers_num = opts->readers_num;
+    int workers_num = opts->workers_num;
+    int err, ret;
+    void *reader_fn = stream != NULL ? (void *)stream_reader_thread : (void *)reader_thread;
+    thread_data writer;
+    thread_data readers[readers_num];
+    thread_data workers[workers_num];
+    shared *sh = malloc(sizeof(shared));
 
-        printf("%s\n", td->shared->buffer);
+    init_shared(sh, inputs, stream, opts);
 
-        // R can continue to read the buffer
-        if ((err = sem_post(&td->shared->sem[R])) != 0)
-            fprintf(stderr, "Error in sem_post: %d\n", err);
+    // create threads
+    for (int i = 0; i < readers_num; i++) {
+        readers[i].thread_i = i + 1;
+        readers[i].seq = 0;
+        readers[i].shared = sh;
+        if ((err = pthread_create(&readers[i].tid, NULL, reader_fn, &readers[i])) != 0) {
+            fprintf(stderr, "Error in pthread_create: %d\n", err);
+            exit(1);
+        }
     }
+    for (int i = 0; i < workers_num; i++) {
+        workers[i].thread_i = i + 1;
+        workers[i].shared = sh;
+        if ((err = pthread_create(&workers[i].tid, NULL, (void *)palindrome_thread, &workers[i])) != 0) {
+            fprintf(stderr, "Error in pthread_create: %d\n", err);
+            exit(1);
+        }
+    }
+    writer.shared = sh;
+    if ((err = pthread_create(&writer.tid, NULL, (void *)writer_thread, &writer)) != 0) {
+        fprintf(stderr, "Error in pthread_create: %d\n", err);
+        exit(1);
+    }
+
+    // waiting for threads to terminate
+    for (int i = 0; i < readers_num; i++) {
+        if ((err = pthread_join(readers[i].tid, NULL)) != 0) {
+            fprintf(stderr, "Error in pthread_join: %d\n", err);
+            exit(1);
+        }
+    }
+
+    for (int i = 0; i < workers_num; i++) {
+        if ((err = pthread_join(workers[i].tid, NULL)) != 0) {
+            fprintf(stderr, "Error in pthread_join: %d\n", err);
+            exit(1);
+        }
+    }
+
+    if ((err = pthread_join(writer.tid, NULL)) != 0) {
+        fprintf(stderr, "Error in pthread_join: %d\n", err);
+        exit(1);
+    }
+    PERF_REPORT();
+    ret = sh->write_failed ? -1 : 0;
+
+    if (opts->count) {
+        output_buffer out;
+
+        output_init(&out, STDOUT_FILENO);
+        // the buffer is freed after an error too
+        err = print_counts(&sh->counts, opts->top_k, &out);
+        if (output_destroy(&out) == -1 || err == -1) {
+            fprintf(stderr, "Error in write\n");
+            ret = -1;
+        }
+
+        // the printed keys were in the arenas of the P threads
+        for (int i = 0; i < workers_num; i++)
+            local_destroy(&workers[i].counts);
+    }
+
+    destroy_shared(sh);
+    return ret;
 }
 
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        printf("Usage: %s <input-file>\n", argv[0]);
-        exit(1);
+    filter_opts filter = { 0, (int)sysconf(_SC_NPROCESSORS_ONLN), false, false, 0, false, NULL };
+    normalize_opts norm = { false, false, false };
+    search_opts search = { 0, false, false };
+    input_set inputs = { 0 };
+    input_stream stream;
+    bool streaming, failed = false;
+    char *str_end;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "r:j:oiauck:s:Fbv")) != -1) {
+        switch (opt) {
+        case 'r':
+            filter.readers_num = (int)strtol(optarg, &str_end, 10);
+            if (*str_end != '\0' || filter.readers_num <= 0 || filter.readers_num > MAX_WORKERS) {
+                fprintf(stderr, "Invalid number of readers: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'j':
+            filter.workers_num = (int)strtol(optarg, &str_end, 10);
+            if (*str_end != '\0' || filter.workers_num <= 0 || filter.workers_num > MAX_WORKERS) {
+                fprintf(stderr, "Invalid number of workers: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'o':
+            filter.ordered = true;
+            break;
+        case 'i':
+            norm.ignore_case = true;
+            break;
+        case 'a':
+            norm.alnum_only = true;
+            break;
+        case 'u':
+            norm.unicode = true;
+            break;
+        case 'c':
+            filter.count = true;
+            break;
+        case 'k':
+            filter.count = true;
+            filter.top_k = strtol(optarg, &str_end, 10);
+            if (*str_end != '\0' || (long)filter.top_k <= 0) {
+                fprintf(stderr, "Invalid number of palindromes: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 's':
+            search.min_len = strtol(optarg, &str_end, 10);
+            if (*str_end != '\0' || (long)search.min_len <= 0) {
+                fprintf(stderr, "Invalid minimum length: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'F':
+            search.whole_file = true;
+            break;
+        case 'b':
+            search.binary = true;
+            break;
+        case 'v':
+            filter.stats = true;
+            break;
+        default:
+            optind = argc;  // print the usage
+            break;
+        }
     }
 
-    FILE *f;
-    if ((f = fopen(argv[1], "r")) == NULL) {
-        fprintf(stderr, "Error in fopen\n");
+    if (argc - optind < 1) {
+        printf("Usage: %s [-r readers] [-j workers] [-o] [-i] [-a] [-u] [-c] [-k top] [-v] <input>...\n", argv[0]);
+        printf("       %s [-j workers] -s <min-length> [-F] [-b] <input-file>\n", argv[0]);
         exit(1);
     }
 
-    int err;
-    thread_data td[3];
-    shared *sh = malloc(sizeof(shared));
-    
-    init_shared(sh);
-
-    // init threads
-    td[R].file = f;
-    for (int i = 0; i < 3; i++)
-        td[i].shared = sh;
-    
-    // create threads
-    if ((err = pthread_create(&td[R].tid, NULL, (void *)reader_thread, &td[R])) != 0) {
-        fprintf(stderr, "Error in pthread_create: %d\n", err);
+    if (search.min_len > 0 && (norm.ignore_case || norm.alnum_only || norm.unicode)) {
+        fprintf(stderr, "The search mode compares raw bytes, -i, -a and -u are not supported\n");
         exit(1);
     }
-    if ((err = pthread_create(&td[P].tid, NULL, (void *)palindrome_thread, &td[P])) != 0) {
-        fprintf(stderr, "Error in pthread_create: %d\n", err);
+
+    for (int i = optind; i < argc; i++) {
+        if (input_add(&inputs, argv[i]) == -1)
+            exit(1);
+    }
+
+    streaming = false;
+    for (size_t i = 0; i < inputs.files_num; i++)
+        streaming |= strcmp(inputs.files[i].path, "-") == 0;
+
+    if (streaming && inputs.files_num != 1) {
+        fprintf(stderr, "The standard input must be the only input\n");
         exit(1);
     }
-    if ((err = pthread_create(&td[W].tid, NULL, (void *)writer_thread, &td[W])) != 0) {
-        fprintf(stderr, "Error in pthread_create: %d\n", err);
+
+    if (search.min_len > 0 && (inputs.files_num != 1 || streaming)) {
+        fprintf(stderr, "The search mode takes a single input file, the standard input is not supported\n");
         exit(1);
     }
 
-    // waiting for threads to terminate 
-    for (int i = 0; i < 3; i++) {
-        if ((err = pthread_join(td[i].tid, NULL)) != 0) {
-            fprintf(stderr, "Error in pthread_create: %d\n", err);
-            exit(1);
-        }     
+    if (input_map(&inputs, filter.ordered) == -1)
+        exit(1);
+
+    // a single R keeps the order of the input
+    if (filter.ordered)
+        filter.readers_num = 1;
+    else if (filter.readers_num == 0)
+        filter.readers_num = (filter.workers_num + 3) / 4;
+    if ((size_t)filter.readers_num > inputs.chunks_num)
+        filter.readers_num = inputs.chunks_num > 0 ? inputs.chunks_num : 1;
+
+    palindrome_kernel_init();
+
+    if (search.min_len > 0) {
+        output_buffer out;
+
+        output_init(&out, STDOUT_FILENO);
+        // the buffer is freed after an error too
+        failed = run_search(inputs.files[0].map, inputs.files[0].size, &search, filter.workers_num, &out) == -1;
+        if (output_destroy(&out) == -1 || failed) {
+            fprintf(stderr, "Error in write\n");
+            failed = true;
+        }
     }
+    else {
+        filter.check = palindrome_normalize_init(norm);
+        if (streaming) {
+            stream_start(&stream, STDIN_FILENO, &inputs.files[0]);
+            failed = run_pipeline(&inputs, &stream, &filter) == -1;
+            stream_destroy(&stream);
+            // the lines after a read error are missing, the output is not the whole one
+            if (stream.failed) {
+                fprintf(stderr, "Error: the standard input has not been read to the end\n");
+                failed = true;
+            }
+        }
+        else
+            failed = run_pipeline(&inputs, NULL, &filter) == -1;
 
-    destroy_shared(sh);
+        if (filter.stats || inputs.files_num > 1)
+            input_report(&inputs, stderr);
+    }
 
-    fclose(f);
+    input_destroy(&inputs);
 
-    exit(0);
-}
\ No newline at end of file
+    exit(failed ? 1 : 0);
+}
@@ -0,0 +1,138 @@
+/**
+ * Palindrome check kernels shared by palindrome_filter and palindrome_bench.
+ * The vector kernels compare a block from the front of the string with the byte-reversed
+ * block at the same distance from the back, stopping at the first mismatch; the middle part,
+ * shorter than two blocks, is left to the next narrower kernel down to the scalar loop.
+ * The widest kernel supported by the CPU is selected at run time by palindrome_kernel_init().
+*/
+
+#ifndef PALINDROME_KERNEL_H
+#define PALINDROME_KERNEL_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PALINDROME_X86
+#endif
+
+typedef bool (*palindrome_fn)(const char *str, size_t len);
+
+typedef struct {
+    const char *name;
+    palindrome_fn fn;
+    bool supported;
+} palindrome_kernel;
+
+static inline bool is_palindrome_scalar(const char *str, size_t len) {
+    for (size_t i = 0; i < len / 2; i++) {
+        if (str[i] != str[len - i - 1])
+            return false;
+    }
+    return true;
+}
+
+#ifdef PALINDROME_X86
+// inlined in the wider kernels, so that the whole check runs with the same encoding and
+// does not pay the transitions between AVX and legacy SSE code
+__attribute__((target("ssse3"), always_inline))
+static inline bool is_palindrome_sse(const char *str, size_t len) {
+    const __m128i reverse = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    size_t i = 0;
+
+    for (; 2 * (i + 16) <= len; i += 16) {
+        __m128i front = _mm_loadu_si128((const __m128i *)(str + i));
+        __m128i back = _mm_loadu_si128((const __m128i *)(str + len - i - 16));
+        back = _mm_shuffle_epi8(back, reverse);
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(front, back)) != 0xFFFF)
+            return false;
+    }
+    return is_palindrome_scalar(str + i, len - 2 * i);
+}
+
+__attribute__((target("avx2"), always_inline))
+static inline bool is_palindrome_avx2(const char *str, size_t len) {
+    // reverses the bytes of each lane, the lanes are swapped afterwards
+    const __m256i reverse = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                             15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    size_t i = 0;
+
+    for (; 2 * (i + 32) <= len; i += 32) {
+        __m256i front = _mm256_loadu_si256((const __m256i *)(str + i));
+        __m256i back = _mm256_loadu_si256((const __m256i *)(str + len - i - 32));
+        back = _mm256_permute4x64_epi64(_mm256_shuffle_epi8(back, reverse), 0x4E);
+        if ((unsigned)_mm256_movemask_epi8(_mm256_cmpeq_epi8(front, back)) != 0xFFFFFFFFu)
+            return false;
+    }
+    return is_palindrome_sse(str + i, len - 2 * i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static bool is_palindrome_avx512(const char *str, size_t len) {
+    const __m512i reverse = _mm512_broadcast_i32x4(_mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8,
+                                                                 7, 6, 5, 4, 3, 2, 1, 0));
+    const __m512i lanes = _mm512_setr_epi64(6, 7, 4, 5, 2, 3, 0, 1);
+    size_t i = 0;
+
+    for (; 2 * (i + 64) <= len; i += 64) {
+        __m512i front = _mm512_loadu_si512((const void *)(str + i));
+        __m512i back = _mm512_loadu_si512((const void *)(str + len - i - 64));
+        back = _mm512_permutexvar_epi64(lanes, _mm512_shuffle_epi8(back, reverse));
+        if (_mm512_cmpneq_epi8_mask(front, back) != 0)
+            return false;
+    }
+    return is_palindrome_avx2(str + i, len - 2 * i);
+}
+
+__attribute__((target("ssse3")))
+static bool palindrome_sse_kernel(const char *str, size_t len) {
+    return is_palindrome_sse(str, len);
+}
+
+__attribute__((target("avx2")))
+static bool palindrome_avx2_kernel(const char *str, size_t len) {
+    return is_palindrome_avx2(str, len);
+}
+#endif
+
+static bool palindrome_scalar_kernel(const char *str, size_t len) {
+    return is_palindrome_scalar(str, len);
+}
+
+// the kernels from the narrowest to the widest
+static palindrome_kernel palindrome_kernels[] = {
+    { "scalar", palindrome_scalar_kernel, true },
+#ifdef PALINDROME_X86
+    { "sse", palindrome_sse_kernel, false },
+    { "avx2", palindrome_avx2_kernel, false },
+    { "avx512", is_palindrome_avx512, false },
+#endif
+};
+
+#define PALINDROME_KERNELS_NUM (int)(sizeof(palindrome_kernels) / sizeof(palindrome_kernels[0]))
+
+static palindrome_fn is_palindrome = palindrome_scalar_kernel;
+
+// detects the supported kernels and selects the widest one, or the one named by the
+// PALINDROME_KERNEL environment variable; must be called before starting the threads
+static void palindrome_kernel_init(void) {
+    const char *forced = getenv("PALINDROME_KERNEL");
+
+#ifdef PALINDROME_X86
+    __builtin_cpu_init();
+    palindrome_kernels[1].supported = __builtin_cpu_supports("ssse3");
+    palindrome_kernels[2].supported = palindrome_kernels[1].supported && __builtin_cpu_supports("avx2");
+    palindrome_kernels[3].supported = palindrome_kernels[2].supported && __builtin_cpu_supports("avx512f") &&
+                                      __builtin_cpu_supports("avx512bw");
+#endif
+
+    for (int i = 0; i < PALINDROME_KERNELS_NUM; i++) {
+        if (!palindrome_kernels[i].supported)
+            continue;
+        if (forced == NULL || strcmp(forced, palindrome_kernels[i].name) == 0)
+            is_palindrome = palindrome_kernels[i].fn;
+    }
+}
+
+#endif
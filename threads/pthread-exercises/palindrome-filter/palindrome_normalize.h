@@ -0,0 +1,289 @@
+/**
+ * Normalized palindrome check: case-insensitive matching (-i), matching that ignores
+ * punctuation and whitespace (-a) and Unicode case folding of UTF-8 text (-u).
+ * No normalized copy of the line is built: a two-pointer scan skips the ignorable characters
+ * and compares the folded ones, using a 256-entry byte table for ASCII and a table of the
+ * code points below U+0800 for UTF-8. Lines that contain nothing to fold or skip are detected
+ * with an SSE2 scan and handed to the raw kernel of palindrome_kernel.h.
+ * The Unicode folding is the simple one-to-one folding of Latin-1, Latin Extended-A, Greek
+ * and Cyrillic; the other code points are compared as they are.
+*/
+
+#ifndef PALINDROME_NORMALIZE_H
+#define PALINDROME_NORMALIZE_H
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "palindrome_kernel.h"
+
+// folded value of an ignorable character
+#define IGNORED 0xFFFF
+// code points below this one are folded through a table
+#define FOLD_TABLE_SIZE 0x800
+// marks an invalid UTF-8 byte, so that it only matches the same byte
+#define INVALID_UTF8 0x110000
+
+typedef struct {
+    bool ignore_case;
+    bool alnum_only;
+    bool unicode;
+} normalize_opts;
+
+static normalize_opts norm_opts;
+static uint16_t byte_fold[256];
+static uint16_t cp_fold[FOLD_TABLE_SIZE];
+
+// punctuation, symbols and combining marks below FOLD_TABLE_SIZE
+static bool is_ignorable_cp(uint32_t cp) {
+    return (cp >= 0x80 && cp <= 0xBF && cp != 0xAA && cp != 0xB5 && cp != 0xBA) || cp == 0xD7 ||
+           cp == 0xF7 || (cp >= 0x2C2 && cp <= 0x2DF) || (cp >= 0x300 && cp <= 0x36F) ||
+           cp == 0x37E || cp == 0x387 || (cp >= 0x55A && cp <= 0x55F) || cp == 0x589;
+}
+
+// simple case folding of the code points below FOLD_TABLE_SIZE
+static uint32_t fold_cp(uint32_t cp) {
+    if (cp < 0x80)
+        return cp >= 'A' && cp <= 'Z' ? cp + 0x20 : cp;
+    if (cp >= 0xC0 && cp <= 0xDE && cp != 0xD7)
+        return cp + 0x20;
+    // Latin Extended-A pairs, with the odd ones out around the dotted I and the long S
+    if (cp >= 0x100 && cp <= 0x12F && cp % 2 == 0)
+        return cp + 1;
+    if (cp >= 0x132 && cp <= 0x137 && cp % 2 == 0)
+        return cp + 1;
+    if (cp >= 0x139 && cp <= 0x148 && cp % 2 == 1)
+        return cp + 1;
+    if (cp >= 0x14A && cp <= 0x177 && cp % 2 == 0)
+        return cp + 1;
+    if (cp == 0x178)
+        return 0xFF;
+    if (cp >= 0x179 && cp <= 0x17E && cp % 2 == 1)
+        return cp + 1;
+    // Greek and Cyrillic
+    if (cp >= 0x391 && cp <= 0x3AB && cp != 0x3A2)
+        return cp + 0x20;
+    if (cp == 0x3C2)
+        return 0x3C3;
+    if (cp >= 0x400 && cp <= 0x40F)
+        return cp + 0x50;
+    if (cp >= 0x410 && cp <= 0x42F)
+        return cp + 0x20;
+    // Cyrillic pairs, with the odd ones uppercase between the palochka and its lowercase
+    if (cp == 0x4C0)
+        return 0x4CF;
+    if (cp >= 0x4C1 && cp <= 0x4CE)
+        return cp % 2 == 1 ? cp + 1 : cp;
+    if (cp >= 0x460 && cp <= 0x4FF && cp % 2 == 0 && (cp < 0x482 || cp >= 0x48A))
+        return cp + 1;
+    return cp;
+}
+
+// returns the folded code point, or IGNORED
+static uint32_t normalize_cp(uint32_t cp) {
+    if (cp < FOLD_TABLE_SIZE)
+        return cp_fold[cp];
+    if (norm_opts.alnum_only && ((cp >= 0x2000 && cp <= 0x206F) || (cp >= 0x3000 && cp <= 0x303F) ||
+                                 cp == 0xFEFF))
+        return IGNORED;
+    return cp;
+}
+
+// decodes the code point starting at str[i], storing its length in *n
+static uint32_t decode_forward(const unsigned char *str, size_t i, size_t end, size_t *n) {
+    unsigned char c = str[i];
+    uint32_t cp;
+    size_t len;
+
+    if (c < 0x80) {
+        *n = 1;
+        return c;
+    }
+    if ((c & 0xE0) == 0xC0) {
+        len = 2;
+        cp = c & 0x1F;
+    }
+    else if ((c & 0xF0) == 0xE0) {
+        len = 3;
+        cp = c & 0x0F;
+    }
+    else if ((c & 0xF8) == 0xF0) {
+        len = 4;
+        cp = c & 0x07;
+    }
+    else {
+        *n = 1;
+        return INVALID_UTF8 + c;
+    }
+
+    if (i + len > end) {
+        *n = 1;
+        return INVALID_UTF8 + c;
+    }
+    for (size_t k = 1; k < len; k++) {
+        if ((str[i + k] & 0xC0) != 0x80) {
+            *n = 1;
+            return INVALID_UTF8 + c;
+        }
+        cp = (cp << 6) | (str[i + k] & 0x3F);
+    }
+
+    *n = len;
+    return cp;
+}
+
+// decodes the code point ending at str[j], storing its length in *n
+static uint32_t decode_backward(const unsigned char *str, size_t start, size_t j, size_t *n) {
+    size_t k = j;
+    uint32_t cp;
+
+    if (str[j] < 0x80) {
+        *n = 1;
+        return str[j];
+    }
+    while (k > start && j - k < 3 && (str[k] & 0xC0) == 0x80)
+        k--;
+
+    cp = decode_forward(str, k, j + 1, n);
+    if (k + *n != j + 1) {
+        *n = 1;
+        return INVALID_UTF8 + str[j];
+    }
+    return cp;
+}
+
+static bool is_palindrome_ascii(const unsigned char *str, size_t len) {
+    size_t i = 0, j = len;
+
+    while (i < j) {
+        // skip the ignorable characters from both ends
+        while (i < j && byte_fold[str[i]] == IGNORED)
+            i++;
+        while (i < j && byte_fold[str[j - 1]] == IGNORED)
+            j--;
+        if (j - i < 2)
+            return true;
+        if (byte_fold[str[i]] != byte_fold[str[j - 1]])
+            return false;
+        i++;
+        j--;
+    }
+    return true;
+}
+
+static bool is_palindrome_utf8(const unsigned char *str, size_t len) {
+    size_t i = 0, j = len;
+    size_t n_front, n_back;
+    uint32_t front, back;
+
+    while (i < j) {
+        // ASCII bytes on both ends take the table path
+        if (str[i] < 0x80 && byte_fold[str[i]] == IGNORED) {
+            i++;
+            continue;
+        }
+        if (str[j - 1] < 0x80 && byte_fold[str[j - 1]] == IGNORED) {
+            j--;
+            continue;
+        }
+
+        front = normalize_cp(decode_forward(str, i, j, &n_front));
+        if (front == IGNORED) {
+            i += n_front;
+            continue;
+        }
+        back = normalize_cp(decode_backward(str, i, j - 1, &n_back));
+        if (back == IGNORED) {
+            j -= n_back;
+            continue;
+        }
+
+        // the middle character
+        if (i + n_front >= j)
+            return true;
+        if (front != back)
+            return false;
+        i += n_front;
+        j -= n_back;
+    }
+    return true;
+}
+
+// true if the line has no byte to fold or skip, so the raw comparison gives the same result
+static bool is_already_normalized(const unsigned char *str, size_t len) {
+    size_t i = 0;
+
+#ifdef __SSE2__
+    const __m128i upper_min = _mm_set1_epi8('A' - 1), upper_max = _mm_set1_epi8('Z' + 1);
+    const __m128i lower_min = _mm_set1_epi8('a' - 1), lower_max = _mm_set1_epi8('z' + 1);
+    const __m128i digit_min = _mm_set1_epi8('0' - 1), digit_max = _mm_set1_epi8('9' + 1);
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)(str + i));
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(block, upper_min), _mm_cmplt_epi8(block, upper_max));
+        __m128i lower = _mm_and_si128(_mm_cmpgt_epi8(block, lower_min), _mm_cmplt_epi8(block, lower_max));
+        __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(block, digit_min), _mm_cmplt_epi8(block, digit_max));
+        // the bytes above 0x7F are negative, their sign bit is set
+        int non_ascii = _mm_movemask_epi8(block);
+        int to_fix = 0;
+
+        if (norm_opts.ignore_case)
+            to_fix |= _mm_movemask_epi8(upper);
+        if (norm_opts.alnum_only)
+            to_fix |= ~(_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(upper, lower), digit)) | non_ascii) & 0xFFFF;
+        if (norm_opts.unicode)
+            to_fix |= non_ascii;
+        if (to_fix != 0)
+            return false;
+    }
+#endif
+    for (; i < len; i++) {
+        if (str[i] >= 0x80 ? norm_opts.unicode : byte_fold[str[i]] != str[i])
+            return false;
+    }
+    return true;
+}
+
+static bool is_palindrome_normalized(const char *str, size_t len) {
+    const unsigned char *s = (const unsigned char *)str;
+
+    if (is_already_normalized(s, len))
+        return is_palindrome(str, len);
+    if (norm_opts.unicode)
+        return is_palindrome_utf8(s, len);
+    return is_palindrome_ascii(s, len);
+}
+
+// builds the fold tables and returns the check to use for the given options
+static palindrome_fn palindrome_normalize_init(normalize_opts opts) {
+    norm_opts = opts;
+
+    if (!opts.ignore_case && !opts.alnum_only && !opts.unicode)
+        return is_palindrome;
+
+    for (int c = 0; c < 256; c++) {
+        byte_fold[c] = c;
+        if (opts.ignore_case && c >= 'A' && c <= 'Z')
+            byte_fold[c] = c + 0x20;
+        if (opts.alnum_only && c < 0x80 && !((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') ||
+                                             (c >= 'a' && c <= 'z')))
+            byte_fold[c] = IGNORED;
+    }
+
+    for (uint32_t cp = 0; cp < FOLD_TABLE_SIZE; cp++) {
+        if (cp < 0x80)
+            cp_fold[cp] = byte_fold[cp];
+        else if (opts.alnum_only && is_ignorable_cp(cp))
+            cp_fold[cp] = IGNORED;
+        else
+            cp_fold[cp] = opts.ignore_case ? fold_cp(cp) : cp;
+    }
+
+    return is_palindrome_normalized;
+}
+
+#endif
@@ -0,0 +1,277 @@
+/**
+ * Search mode of palindrome_filter (-s): reports every maximal palindromic substring of at
+ * least the given length, that is, for every center the longest palindrome around it.
+ * The radii are computed with Manacher's algorithm, in linear time, inside each line or, with
+ * -F, across the whole file (newlines are ordinary bytes).
+ * The mapping is split in chunks searched in parallel by a round of worker threads; the
+ * results of a round are written in file order before the next round starts.
+ * In whole-file mode every worker runs Manacher on its chunk extended by SEARCH_OVERLAP bytes
+ * on both sides and reports only the centers inside the chunk. A palindrome that reaches the
+ * edge of the extended window may continue outside it: then the chunk is searched again after
+ * the round, with the window doubled on that side and, on the right, the chunk merged with the
+ * following ones, until no palindrome reaches an edge. The search stays linear also on long
+ * palindromes and runs (a file of a single byte is searched as one window, with the radii of
+ * the whole file in memory).
+ * The results are written through an output_buffer as "offset<TAB>length" lines, or with -b
+ * as pairs of native 64-bit integers.
+*/
+
+#ifndef PALINDROME_SEARCH_H
+#define PALINDROME_SEARCH_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "output_buffer.h"
+
+#ifndef SEARCH_CHUNK_SIZE
+#define SEARCH_CHUNK_SIZE (4 << 20)
+#endif
+#ifndef SEARCH_OVERLAP
+#define SEARCH_OVERLAP (64 << 10)
+#endif
+
+typedef struct {
+    size_t min_len;
+    bool whole_file;
+    bool binary;
+} search_opts;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t len;
+} search_match;
+
+typedef struct {
+    pthread_t tid;
+    const char *map;
+    size_t size;
+    size_t start;
+    size_t end;
+    const search_opts *opts;
+
+    // Manacher radii, reused between chunks
+    int *odd;
+    int *even;
+    size_t radii_size;
+
+    search_match *matches;
+    size_t matches_num;
+    size_t matches_size;
+    bool unresolved;  // a palindrome reached a clipped edge of the window
+} search_worker;
+
+static void add_match(search_worker *w, size_t offset, size_t len) {
+    if (w->matches_num == w->matches_size) {
+        w->matches_size = w->matches_size == 0 ? 1024 : 2 * w->matches_size;
+        w->matches = realloc(w->matches, w->matches_size * sizeof(search_match));
+    }
+    w->matches[w->matches_num].offset = offset;
+    w->matches[w->matches_num].len = len;
+    w->matches_num++;
+}
+
+// odd[i]: palindromes centered on t[i], even[i]: palindromes centered between t[i - 1] and t[i]
+static void manacher(search_worker *w, const char *t, size_t n) {
+    long k;
+
+    if (n > w->radii_size) {
+        w->radii_size = n;
+        w->odd = realloc(w->odd, n * sizeof(int));
+        w->even = realloc(w->even, n * sizeof(int));
+    }
+
+    for (long i = 0, l = 0, r = -1; i < (long)n; i++) {
+        k = i > r ? 1 : (w->odd[l + r - i] < r - i + 1 ? w->odd[l + r - i] : r - i + 1);
+        while (i - k >= 0 && i + k < (long)n && t[i - k] == t[i + k])
+            k++;
+        w->odd[i] = k;
+        if (i + k - 1 > r) {
+            l = i - k + 1;
+            r = i + k - 1;
+        }
+    }
+
+    for (long i = 0, l = 0, r = -1; i < (long)n; i++) {
+        k = i > r ? 0 : (w->even[l + r - i + 1] < r - i + 1 ? w->even[l + r - i + 1] : r - i + 1);
+        while (i - k - 1 >= 0 && i + k < (long)n && t[i - k - 1] == t[i + k])
+            k++;
+        w->even[i] = k;
+        if (i + k - 1 > r) {
+            l = i - k;
+            r = i + k - 1;
+        }
+    }
+}
+
+// reports the palindromes centered in [from, to) of the text t, that starts at base in the map
+static void report_centers(search_worker *w, size_t base, size_t from, size_t to) {
+    for (size_t i = from; i < to; i++) {
+        if ((size_t)(2 * w->odd[i] - 1) >= w->opts->min_len)
+            add_match(w, base + i - (w->odd[i] - 1), 2 * w->odd[i] - 1);
+        if (w->even[i] > 0 && (size_t)(2 * w->even[i]) >= w->opts->min_len)
+            add_match(w, base + i - w->even[i], 2 * w->even[i]);
+    }
+}
+
+#define SEARCH_LEFT 1
+#define SEARCH_RIGHT 2
+
+// the edges of the window [base, base + n) that a palindrome centered in [from, to) reaches,
+// without the ones of the mapping
+static int clipped_edges(search_worker *w, size_t base, size_t n, size_t from, size_t to) {
+    int edges = 0;
+
+    for (size_t i = from; i < to; i++) {
+        if ((i + 1 == (size_t)w->odd[i] || (w->even[i] > 0 && i == (size_t)w->even[i])) && base > 0)
+            edges |= SEARCH_LEFT;
+        if ((i + w->odd[i] == n || i + w->even[i] == n) && base + n < w->size)
+            edges |= SEARCH_RIGHT;
+    }
+    return edges;
+}
+
+// searches the chunk of w again with a larger window, until no palindrome reaches a clipped
+// edge: the margin doubles on the clipped side and, on the right, the chunk doubles too, so
+// its centers are reported once; the chunks start at multiples of SEARCH_CHUNK_SIZE, so the
+// end stays on the start of a chunk
+static void search_merged(search_worker *w) {
+    size_t left_margin = SEARCH_OVERLAP, right_margin = SEARCH_OVERLAP;
+    size_t from, to;
+    int edges;
+
+    while (1) {
+        from = w->start > left_margin ? w->start - left_margin : 0;
+        to = w->end + right_margin < w->size ? w->end + right_margin : w->size;
+        manacher(w, w->map + from, to - from);
+        if ((edges = clipped_edges(w, from, to - from, w->start - from, w->end - from)) == 0)
+            break;
+        if (edges & SEARCH_LEFT)
+            left_margin *= 2;
+        if (edges & SEARCH_RIGHT) {
+            right_margin *= 2;
+            w->end = w->size - w->end > w->end - w->start ? 2 * w->end - w->start : w->size;
+        }
+    }
+
+    w->matches_num = 0;
+    report_centers(w, from, w->start - from, w->end - from);
+    w->unresolved = false;
+}
+
+static void search_chunk(search_worker *w) {
+    const char *p = w->map + w->start;
+    const char *end = w->map + w->end;
+    const char *nl;
+    size_t from, to;
+
+    w->matches_num = 0;
+    w->unresolved = false;
+
+    if (!w->opts->whole_file) {
+        // the chunk starts and ends on a line boundary
+        while (p < end) {
+            if ((nl = memchr(p, '\n', end - p)) == NULL)
+                nl = end;
+            if ((size_t)(nl - p) >= w->opts->min_len) {
+                manacher(w, p, nl - p);
+                report_centers(w, p - w->map, 0, nl - p);
+            }
+            p = nl + 1;
+        }
+        return;
+    }
+
+    from = w->start > SEARCH_OVERLAP ? w->start - SEARCH_OVERLAP : 0;
+    to = w->end + SEARCH_OVERLAP < w->size ? w->end + SEARCH_OVERLAP : w->size;
+    manacher(w, w->map + from, to - from);
+    // searched again by run_search, after the round
+    if (clipped_edges(w, from, to - from, w->start - from, w->end - from) != 0)
+        w->unresolved = true;
+    else
+        report_centers(w, from, w->start - from, w->end - from);
+}
+
+static int write_matches(search_worker *w, output_buffer *out) {
+    char line[48];
+    int n;
+
+    for (size_t i = 0; i < w->matches_num; i++) {
+        if (w->opts->binary) {
+            if (output_append(out, (const char *)&w->matches[i], sizeof(search_match), '\0') == -1)
+                return -1;
+            continue;
+        }
+        n = snprintf(line, sizeof(line), "%llu\t%llu", (unsigned long long)w->matches[i].offset,
+                     (unsigned long long)w->matches[i].len);
+        if (output_append(out, line, n, '\n') == -1)
+            return -1;
+    }
+    return 0;
+}
+
+// searches the mapping with workers_num threads, writing the results to out in file order
+static int run_search(const char *map, size_t size, const search_opts *opts, int workers_num, output_buffer *out) {
+    search_worker *workers = calloc(workers_num, sizeof(search_worker));
+    size_t pos = 0, covered;
+    const char *nl;
+    int n, err, ret = 0;
+
+    while (pos < size && ret == 0) {
+        // assign a chunk to each worker of the round
+        for (n = 0; n < workers_num && pos < size; n++) {
+            workers[n].map = map;
+            workers[n].size = size;
+            workers[n].opts = opts;
+            workers[n].start = pos;
+            workers[n].end = size - pos > SEARCH_CHUNK_SIZE ? pos + SEARCH_CHUNK_SIZE : size;
+            if (!opts->whole_file && workers[n].end < size) {
+                nl = memchr(map + workers[n].end, '\n', size - workers[n].end);
+                workers[n].end = nl == NULL ? size : (size_t)(nl - map) + 1;
+            }
+            pos = workers[n].end;
+        }
+
+        for (int i = 1; i < n; i++) {
+            if ((err = pthread_create(&workers[i].tid, NULL, (void *)search_chunk, &workers[i])) != 0) {
+                fprintf(stderr, "Error in pthread_create: %d\n", err);
+                exit(1);
+            }
+        }
+        search_chunk(&workers[0]);
+        for (int i = 1; i < n; i++) {
+            if ((err = pthread_join(workers[i].tid, NULL)) != 0) {
+                fprintf(stderr, "Error in pthread_join: %d\n", err);
+                exit(1);
+            }
+        }
+
+        // a merged chunk covers the following ones up to its new end
+        covered = 0;
+        for (int i = 0; i < n && ret == 0; i++) {
+            if (workers[i].start < covered)
+                continue;
+            if (workers[i].unresolved)
+                search_merged(&workers[i]);
+            ret = write_matches(&workers[i], out);
+            covered = workers[i].end;
+        }
+        if (covered > pos)
+            pos = covered;
+    }
+
+    for (int i = 0; i < workers_num; i++) {
+        free(workers[i].odd);
+        free(workers[i].even);
+        free(workers[i].matches);
+    }
+    free(workers);
+
+    return ret;
+}
+
+#endif
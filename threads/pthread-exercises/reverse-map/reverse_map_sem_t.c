@@ -7,6 +7,13 @@
  * content of the file.
  * To open the file and reverse the content and print the content you need to use
  * file mapping.
+ * The reversal mode is selected with -m: bytes (default), utf8 (code points), lines (line
+ * order, like tac) or records:<size> (fixed-size records); each file is reversed by up to
+ * -j worker threads.
+ * The shared buffer is a bounded_queue (../../common/bounded_queue.h) with semaphores as sync
+ * policy, another one can be chosen with -DQUEUE_SYNC=QUEUE_SYNC_... and -DQUEUE_WAIT=QUEUE_WAIT_....
+ * Built with -DPERFCOUNT, the counters of the swap and fix-up passes and of the printing are
+ * printed on stderr at the end (../../common/perfcount.h).
 */
 
 #include <stdlib.h>
@@ -18,20 +25,24 @@
 #include <sys/mman.h>
 #include <linux/limits.h>
 #include <pthread.h>
-#include <semaphore.h>
+
+#include "reverse_modes.h"
 
 #define BUFFER_SIZE 4
 
+// the paths are the arguments of the program, the buffer holds pointers to them
+#define QUEUE_NAME path_queue
+#define QUEUE_TYPE char *
+#define QUEUE_CAPACITY BUFFER_SIZE
+#ifndef QUEUE_SYNC
+#define QUEUE_SYNC QUEUE_SYNC_SEM
+#endif
+#include "../../common/bounded_queue.h"
+
 typedef struct {
-    char buffer[BUFFER_SIZE][PATH_MAX];
-    int in;
-    int out;
+    path_queue queue;
     int paths_num;
-    int paths_to_consume;
-
-    sem_t mutex;
-    sem_t empty;
-    sem_t full;
+    reverse_opts opts;
 } shared_data;
 
 typedef struct {
@@ -42,34 +53,16 @@ typedef struct {
     shared_data *shared;
 } threads_data;
 
-void init_shared(shared_data *shared, int paths_num) {
-    shared->in = shared->out = 0;
+void init_shared(shared_data *shared, int paths_num, reverse_opts opts) {
+    path_queue_init(&shared->queue);
 
     shared->paths_num = paths_num;
-
-    shared->paths_to_consume = 0;
-
-    // semaphores init
-    int err;
-    if ((err = sem_init(&shared->empty, 0, BUFFER_SIZE)) != 0) {
-        fprintf(stderr, "Error in sem_init: %d\n", err);
-        return;
-    }
-    if ((err = sem_init(&shared->full, 0, 0)) != 0) {
-        fprintf(stderr, "Error in sem_init: %d\n", err);
-        return;       
-    }
-    if ((err = sem_init(&shared->mutex, 0, 1)) != 0) {
-        fprintf(stderr, "Error in sem_init: %d\n", err);
-        return;
-    }
+    shared->opts = opts;
 }
 
 void destroy_shared(shared_data *shared) {
-    sem_destroy(&shared->empty);
-    sem_destroy(&shared->full);
-    sem_destroy(&shared->mutex);
-    free(shared);    
+    path_queue_destroy(&shared->queue);
+    free(shared);
 }
 
 void reverse_file(void *arg) {
@@ -77,8 +70,8 @@ void reverse_file(void *arg) {
     int fd;
     struct stat statbuf;
     char *map;
-    char tmp;
-    int err;
+
+    PERF_THREAD("reverse_file");
 
     // map the file to reverse it
     if ((fd = open(td->filepath, O_RDWR)) == -1) {
@@ -102,11 +95,10 @@ void reverse_file(void *arg) {
     }
 
     // reverse the file
-    for (int i = 0; i < (statbuf.st_size / 2); i++) {
-        tmp = map[statbuf.st_size - i - 1];
-        map[statbuf.st_size - i - 1] = map[i];
-        map[i] = tmp;
-    }
+    PERF_BEGIN("reverse_map");
+    if (reverse_map(map, statbuf.st_size, &td->shared->opts) == -1)
+        fprintf(stderr, "Error in reverse_map: %s\n", td->filepath);
+    PERF_END("reverse_map");
 
     fprintf(stdout, "[reverse_file%d]: %s\n", td->thread_i ,td->filepath);
 
@@ -121,24 +113,8 @@ void reverse_file(void *arg) {
         return;
     }
 
-    // down(empty)
-    if ((err = sem_wait(&td->shared->empty)) != 0)
-        fprintf(stderr, "Error in sem_wait: %d\n", err);
-    // down(mutex)
-    if ((err = sem_wait(&td->shared->mutex)) != 0)
-        fprintf(stderr, "Error in sem_wait: %d\n", err);
-
     // insert reversed file path
-    strncpy(td->shared->buffer[td->shared->in], td->filepath, PATH_MAX);
-
-    td->shared->in = (td->shared->in + 1) % BUFFER_SIZE;
-
-    // up(mutex)
-    if ((err = sem_post(&td->shared->mutex)) != 0)
-        fprintf(stderr, "Error in sem_post: %d\n", err);
-    // up(full)
-    if ((err = sem_post(&td->shared->full)) != 0)
-        fprintf(stderr, "Error in sem_post: %d\n", err);
+    path_queue_push(&td->shared->queue, &td->filepath, NULL);
 }
 
 void print_file(void *arg) {
@@ -146,28 +122,11 @@ void print_file(void *arg) {
     int fd;
     struct stat statbuf;
     char *map;
-    int err;
-
-    while (td->shared->paths_to_consume < td->shared->paths_num) {
-        // down(full)
-        if ((err = sem_wait(&td->shared->full)) != 0)
-            fprintf(stderr, "Error in sem_wait: %d\n", err);
-        // down(mutex)
-        if ((err = sem_wait(&td->shared->mutex)) != 0)
-            fprintf(stderr, "Error in sem_wait: %d\n", err);
 
+    PERF_THREAD("print_file");
+    for (int i = 0; i < td->shared->paths_num; i++) {
         // consume reversed file path
-        td->filepath = td->shared->buffer[td->shared->out];
-
-        td->shared->out = (td->shared->out + 1) % BUFFER_SIZE;
-        td->shared->paths_to_consume++;
-
-        // up(mutex)
-        if ((err = sem_post(&td->shared->mutex)) != 0)
-            fprintf(stderr, "Error in sem_post: %d\n", err);
-        // up(empty)
-        if ((err = sem_post(&td->shared->empty)) != 0)
-            fprintf(stderr, "Error in sem_post: %d\n", err);
+        path_queue_pop(&td->shared->queue, &td->filepath, NULL);
 
         // map the file to show content
         if ((fd = open(td->filepath, O_RDONLY)) == -1)
@@ -180,9 +139,11 @@ void print_file(void *arg) {
             fprintf(stderr, "Error in mmap");
 
         // show content
+        PERF_BEGIN("print");
         fprintf(stdout, "\n[print_file]: %s\n", td->filepath);
         puts(map);
         fprintf(stdout, "\n");
+        PERF_END("print");
 
         if (close(fd) == -1)
             fprintf(stderr, "Error in close");
@@ -196,22 +157,47 @@ void print_file(void *arg) {
 }
 
 int main(int argc, char **argv) {
-    if (argc < 2) {
-        fprintf(stderr, "Usage: %s <input-file-1> <input-file-2> ... <input-file-n>\n", argv[0]);
+    reverse_opts opts = { REVERSE_BYTES, 0, (int)sysconf(_SC_NPROCESSORS_ONLN) };
+    char *str_end;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "m:j:")) != -1) {
+        switch (opt) {
+        case 'm':
+            if (parse_reverse_mode(optarg, &opts) == -1) {
+                fprintf(stderr, "Invalid mode: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'j':
+            opts.threads = (int)strtol(optarg, &str_end, 10);
+            if (*str_end != '\0' || opts.threads <= 0) {
+                fprintf(stderr, "Invalid number of threads: %s\n", optarg);
+                exit(1);
+            }
+            break;
+        default:
+            optind = argc;  // print the usage
+            break;
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-m bytes|utf8|lines|records:<size>] [-j threads] <input-file-1> <input-file-2> ... <input-file-n>\n", argv[0]);
         exit(1);
     }
 
-    int file_paths_num = argc - 1;
+    int file_paths_num = argc - optind;
     threads_data td[file_paths_num + 1];
     shared_data *shared = malloc(sizeof(shared_data));
     int err;
 
-    init_shared(shared, file_paths_num);
+    init_shared(shared, file_paths_num, opts);
 
     // init and create reverse_file threads
     for (int i = 0; i < file_paths_num; i++) {
         td[i].thread_i = i + 1;
-        td[i].filepath = argv[i + 1];
+        td[i].filepath = argv[optind + i];
         td[i].shared = shared;
 
         if ((err = pthread_create(&td[i].tid, NULL, (void *)reverse_file, &td[i])) != 0) {
@@ -235,6 +221,7 @@ int main(int argc, char **argv) {
         }
     }
 
+    PERF_REPORT();
     destroy_shared(shared);
 
     exit(0);
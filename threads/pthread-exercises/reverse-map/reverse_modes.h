@@ -0,0 +1,267 @@
+/**
+ * Content-aware reversal of a mapped file, shared by the reverse_map variants.
+ * Every mode is implemented as a full byte reversal followed by a fix-up pass that
+ * reverses back each unit that must keep its internal order:
+ * -   bytes:      plain byte reversal, no fix-up;
+ * -   utf8:       the bytes of every multi-byte UTF-8 code point;
+ * -   lines:      the content of every line, so that the line order is reversed (like tac);
+ * -   records:N:  every fixed-size record of N bytes.
+ * Both passes split the mapping in chunks handled by a pool of worker threads; the chunks
+ * of the fix-up pass are aligned to unit boundaries so that no unit is shared between workers.
+*/
+
+#ifndef REVERSE_MODES_H
+#define REVERSE_MODES_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "../../common/perfcount.h"
+
+// files smaller than this are not worth splitting between threads
+#ifndef MIN_CHUNK_SIZE
+#define MIN_CHUNK_SIZE (1 << 20)
+#endif
+#define MAX_REVERSE_THREADS 64
+
+typedef enum { REVERSE_BYTES, REVERSE_UTF8, REVERSE_LINES, REVERSE_RECORDS } reverse_mode;
+
+typedef struct {
+    reverse_mode mode;
+    size_t record_size;
+    int threads;
+} reverse_opts;
+
+typedef struct {
+    pthread_t tid;
+    char *map;
+    size_t size;
+    size_t start;
+    size_t end;
+    const reverse_opts *opts;
+} reverse_chunk;
+
+// parses "bytes", "utf8", "lines" or "records:<size>"
+static int parse_reverse_mode(const char *arg, reverse_opts *opts) {
+    char *str_end;
+
+    if (strcmp(arg, "bytes") == 0)
+        opts->mode = REVERSE_BYTES;
+    else if (strcmp(arg, "utf8") == 0)
+        opts->mode = REVERSE_UTF8;
+    else if (strcmp(arg, "lines") == 0)
+        opts->mode = REVERSE_LINES;
+    else if (strncmp(arg, "records:", 8) == 0) {
+        long size = strtol(arg + 8, &str_end, 10);
+        if (*str_end != '\0' || size <= 0)
+            return -1;
+        opts->mode = REVERSE_RECORDS;
+        opts->record_size = size;
+    }
+    else
+        return -1;
+
+    return 0;
+}
+
+static void reverse_range(char *p, size_t n) {
+    char tmp;
+
+    for (size_t i = 0; i < n / 2; i++) {
+        tmp = p[n - i - 1];
+        p[n - i - 1] = p[i];
+        p[i] = tmp;
+    }
+}
+
+static inline int is_utf8_cont(char c) {
+    return ((unsigned char)c & 0xC0) == 0x80;
+}
+
+// returns the position of the first UTF-8 continuation byte in [p, end), or end
+static const char *find_utf8_cont(const char *p, const char *end) {
+#ifdef __SSE2__
+    // continuation bytes are 0x80..0xBF, that is -128..-65 as signed bytes
+    const __m128i limit = _mm_set1_epi8(-64);
+
+    while (end - p >= 16) {
+        __m128i block = _mm_loadu_si128((const __m128i *)p);
+        int mask = _mm_movemask_epi8(_mm_cmplt_epi8(block, limit));
+        if (mask != 0)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+#endif
+    while (p < end && !is_utf8_cont(*p))
+        p++;
+    return p;
+}
+
+// swaps the bytes [start, end) of the first half with their mirror in the second half
+static void reverse_swap_chunk(reverse_chunk *c) {
+    char *head = c->map;
+    char *tail = c->map + c->size - 1;
+    char tmp;
+
+    // the first chunk runs on the thread of the file, which has a role already
+    PERF_THREAD("reverse_worker");
+    PERF_BEGIN("swap");
+    for (size_t i = c->start; i < c->end; i++) {
+        tmp = tail[-(long)i];
+        tail[-(long)i] = head[i];
+        head[i] = tmp;
+    }
+    PERF_END("swap");
+}
+
+// restores the internal order of the units starting in [start, end)
+static void reverse_fixup_chunk(reverse_chunk *c) {
+    char *p = c->map + c->start;
+    char *end = c->map + c->end;
+    char *map_end = c->map + c->size;
+    char *q;
+
+    PERF_THREAD("reverse_worker");
+    PERF_BEGIN("fixup");
+    switch (c->opts->mode) {
+    case REVERSE_UTF8:
+        // after the byte reversal a code point appears as its continuation bytes followed
+        // by the leading byte
+        while ((p = (char *)find_utf8_cont(p, end)) < end) {
+            q = p;
+            while (q < map_end && is_utf8_cont(*q))
+                q++;
+            // malformed sequences are left untouched
+            if (q < map_end && ((unsigned char)*q & 0xC0) == 0xC0 && q - p <= 3)
+                reverse_range(p, q - p + 1);
+            p = q + 1;
+        }
+        break;
+    case REVERSE_LINES:
+        while (p < end) {
+            if ((q = memchr(p, '\n', map_end - p)) == NULL)
+                q = map_end;
+            reverse_range(p, q - p);
+            p = q + 1;
+        }
+        break;
+    case REVERSE_RECORDS:
+        for (; p < end; p += c->opts->record_size)
+            reverse_range(p, c->opts->record_size);
+        break;
+    default:
+        break;
+    }
+    PERF_END("fixup");
+}
+
+// moves a chunk boundary forward to the start of the next unit
+static size_t align_chunk_boundary(char *map, size_t size, size_t pos, const reverse_opts *opts) {
+    char *q;
+
+    if (pos == 0 || pos >= size)
+        return pos;
+
+    switch (opts->mode) {
+    case REVERSE_UTF8:
+        // a run of continuation bytes belongs to the chunk where it starts
+        while (pos < size && is_utf8_cont(map[pos]) && is_utf8_cont(map[pos - 1]))
+            pos++;
+        if (pos < size && is_utf8_cont(map[pos - 1]))
+            pos++;  // skip the leading byte closing the run
+        return pos > size ? size : pos;
+    case REVERSE_LINES:
+        if (map[pos - 1] == '\n')
+            return pos;
+        if ((q = memchr(map + pos, '\n', size - pos)) == NULL)
+            return size;
+        return q - map + 1;
+    case REVERSE_RECORDS:
+        pos += (opts->record_size - pos % opts->record_size) % opts->record_size;
+        return pos > size ? size : pos;
+    default:
+        return pos;
+    }
+}
+
+// runs fn over n chunks, each on its own thread (the first one on the calling thread); the
+// chunks whose thread cannot be created are run on the calling thread too, so the whole
+// mapping is always processed
+static int run_chunks(reverse_chunk *chunks, int n, void (*fn)(reverse_chunk *)) {
+    int started, err, ret = 0;
+
+    for (started = 1; started < n; started++) {
+        if ((err = pthread_create(&chunks[started].tid, NULL, (void *)fn, &chunks[started])) != 0) {
+            fprintf(stderr, "Error in pthread_create: %d\n", err);
+            break;
+        }
+    }
+
+    fn(&chunks[0]);
+    for (int i = started; i < n; i++)
+        fn(&chunks[i]);
+
+    for (int i = 1; i < started; i++) {
+        if ((err = pthread_join(chunks[i].tid, NULL)) != 0) {
+            fprintf(stderr, "Error in pthread_join: %d\n", err);
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+// reverses the mapping according to the selected mode
+static int reverse_map(char *map, size_t size, const reverse_opts *opts) {
+    reverse_chunk chunks[MAX_REVERSE_THREADS];
+    size_t len = size;
+    size_t half;
+    int threads = opts->threads;
+
+    if (opts->mode == REVERSE_RECORDS && size % opts->record_size != 0) {
+        fprintf(stderr, "File size %zu is not a multiple of the record size %zu\n", size, opts->record_size);
+        return -1;
+    }
+
+    // a trailing newline stays at the end of the file
+    if (opts->mode == REVERSE_LINES && len > 0 && map[len - 1] == '\n')
+        len--;
+
+    if (threads < 1)
+        threads = 1;
+    if (threads > MAX_REVERSE_THREADS)
+        threads = MAX_REVERSE_THREADS;
+    if ((size_t)threads > len / MIN_CHUNK_SIZE + 1)
+        threads = len / MIN_CHUNK_SIZE + 1;
+
+    // byte reversal: every thread swaps a slice of the first half with its mirror
+    half = len / 2;
+    for (int i = 0; i < threads; i++) {
+        chunks[i].map = map;
+        chunks[i].size = len;
+        chunks[i].start = half * i / threads;
+        chunks[i].end = half * (i + 1) / threads;
+        chunks[i].opts = opts;
+    }
+    if (run_chunks(chunks, threads, reverse_swap_chunk) == -1)
+        return -1;
+
+    if (opts->mode == REVERSE_BYTES)
+        return 0;
+
+    // fix-up: the boundaries are aligned before starting, so the workers never touch
+    // the same unit
+    for (int i = 0; i < threads; i++) {
+        chunks[i].start = align_chunk_boundary(map, len, len * i / threads, opts);
+        chunks[i].end = align_chunk_boundary(map, len, len * (i + 1) / threads, opts);
+    }
+    return run_chunks(chunks, threads, reverse_fixup_chunk);
+}
+
+#endif